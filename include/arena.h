@@ -0,0 +1,44 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Bump allocator for the scratch buffers of one frame (cell lists,
+// union-find forests, partitions, cluster CSR arrays). Buffers are never
+// freed one by one: arena_reset() drops them all before the next frame.
+// A frame that does not fit spills into extra blocks; the next reset
+// replaces them by one block of the frame's total size, so after the
+// first frame of a trajectory the frames allocate nothing from the heap.
+// Every function accepts a NULL arena and then falls back to malloc/free.
+struct arena_spill;
+
+struct frame_arena {
+    char *base;
+    size_t capacity, used;
+    arena_spill *spills;        // blocks beyond capacity in this frame
+    int n_spills;               // blocks malloc()ed beyond capacity in this frame
+    size_t frame_bytes;         // bytes requested in this frame
+    size_t peak_bytes;          // largest frame so far
+    long long n_grows;          // times the block was (re)allocated
+};
+
+void init_arena(frame_arena *a);
+
+void free_arena(frame_arena *a);
+
+// Starts a new frame: invalidates every buffer handed out since the last reset
+void arena_reset(frame_arena *a);
+
+// 64-byte aligned, uninitialised
+void *arena_alloc(frame_arena *a, size_t bytes);
+
+// free() without an arena, no-op with one
+void arena_release(frame_arena *a, void *p);
+
+template <typename T>
+inline T *arena_array(frame_arena *a, size_t n)
+{
+    return (T *)arena_alloc(a, sizeof(T) * (n > 0 ? n : 1));
+}
+
+#endif // ARENA_H
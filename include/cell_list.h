@@ -0,0 +1,80 @@
+#ifndef CELL_LIST_H
+#define CELL_LIST_H
+
+#include "arena.h"
+
+// Order of the cells in memory (--reorder). The rows of cells along x
+// are kept whole, so consecutive cells along x can be scanned in one
+// kernel call, and the rows are ordered in (y, z). In row-major order the
+// rows above and behind a row are a whole plane away; along a
+// space-filling curve nearby rows, and so their particles, are stored
+// close together, which keeps the scans of very large systems in cache.
+enum cell_order {
+    CELL_ORDER_ROW_MAJOR,
+    CELL_ORDER_MORTON,          // Z-order: bits of ky and kz interleaved
+    CELL_ORDER_HILBERT          // Hilbert curve: consecutive rows always adjacent
+};
+
+// Order of the cell lists built from now on (default row-major)
+void set_cell_order(cell_order order);
+
+// Linked-cell spatial binning of a set of particles.
+// The region is split into cells whose edges are at least one cut-off long,
+// so every neighbour of a particle lies in one of the (up to) 27 cells
+// surrounding its own cell.
+// Particles may carry a key (e.g. the selection they belong to); they are
+// then sorted by (key, cell), so the particles of one key in one cell are
+// a contiguous run and queries can be restricted to a key without scanning.
+// Only the non-empty runs are indexed, and every cell lists its runs, so
+// the index grows with the particles and the cells, not with the keys.
+// Cells are identified by their slot, their position in memory order;
+// run_cell, particle_cell and cell_neighbours() all use slots.
+struct cell_list {
+    int nx, ny, nz;          // number of cells along x, y and z
+    float x0, y0, z0;        // lower corner of the binned region
+    float cx, cy, cz;        // cell edge lengths
+    bool use_pbc;            // cells wrap around the periodic box
+    int n_keys;              // 1 without keys
+    cell_order order;
+    int *rank_row;           // row ky + ny*kz at every position along the curve,
+    int *row_rank;           // and the position of every row; NULL if row-major.
+                             // Cell (kx, ky, kz) is in slot row_rank[row]*nx + kx
+    int n_runs;              // non-empty (key, cell) runs, in (key, slot) order
+    int *run_start;          // n_runs+1 offsets into cell_particles
+    int *run_key, *run_cell; // key and slot of every run
+    int *cell_run_start;     // nx*ny*nz+1 offsets into cell_runs
+    int *cell_runs;          // runs of every cell, by increasing key
+    int *cell_particles;     // particle indices grouped by cell (ascending within a cell);
+                             // the permutation from sorted positions to input indices
+    int *particle_cell;      // slot of every particle
+    float *xs, *ys, *zs;     // positions in cell_particles order
+    frame_arena *arena;      // owner of the arrays (NULL: malloc)
+};
+
+// Bins n_particles positions into cells of edge >= dist_cluster.
+// With use_pbc the box Lx x Ly x Lz is used (positions are wrapped into it),
+// otherwise the bounding box of the positions. 2D systems get a single
+// layer of cells along z. keys (values in [0, n_keys)) may be NULL.
+// The arrays are taken from arena when one is given.
+void build_cell_list(cell_list *cl,
+                     const float *rx, const float *ry, const float *rz,
+                     int n_particles, float dist_cluster,
+                     float Lx, float Ly, float Lz, bool use_pbc,
+                     int dimensions = 3,
+                     const int *keys = NULL, int n_keys = 1,
+                     frame_arena *arena = NULL);
+
+// Writes the slots of the distinct cells neighbouring slot `cell` (itself
+// included) to `neighbours` (room for 27 entries) and returns their number.
+// Along a curve they are sorted, so runs adjacent in memory can be merged.
+int cell_neighbours(const cell_list *cl, int cell, int *neighbours);
+
+// Writes the ranges [range_begin, range_end) of cell_particles holding the
+// particles of `key` in the cells neighbouring slot `cell` (itself
+// included), with ranges adjacent in memory merged (room for 27 entries),
+// and returns their number
+int neighbour_ranges(const cell_list *cl, int key, int cell, int *range_begin, int *range_end);
+
+void free_cell_list(cell_list *cl);
+
+#endif // CELL_LIST_H
@@ -0,0 +1,122 @@
+#ifndef CLUSTER_IO_H
+#define CLUSTER_IO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// Cluster result files written by hoomd_cluster2 and read by clout_ana2.
+//
+// CLUSTER_TEXT is the original clustering.out layout ("Cluster : i",
+// "Molecules (n):" and one particle id per line).
+// The binary layout is a cluster_file_header followed by
+//   uncompressed: uint64 offsets[n_clusters + 1], int32 ids[n_members]
+//   compressed:   per cluster a varint size, then the ids as zigzag
+//                 varint deltas (first id relative to 0)
+// All integers are little-endian. Readers detect the format from the magic.
+// CLUSTER_STATS_ONLY writes no file: only the cluster_stats are kept.
+enum cluster_format {
+    CLUSTER_TEXT,
+    CLUSTER_BINARY,
+    CLUSTER_BINARY_COMPRESSED,
+    CLUSTER_STATS_ONLY
+};
+
+#define CLUSTER_FILE_MAGIC "MDCLBIN"
+#define CLUSTER_FILE_VERSION 1
+#define CLUSTER_FLAG_COMPRESSED 1u
+
+struct cluster_file_header {
+    char magic[8];              // CLUSTER_FILE_MAGIC, NUL-terminated
+    uint32_t version;
+    uint32_t flags;
+    int64_t n_links;
+    int64_t n_clusters;
+    int64_t n_members;
+    int32_t n_iterations;
+    int32_t reserved;
+    uint64_t payload_bytes;     // bytes following the header
+};
+
+// Writes the clusters given in CSR form (members of cluster c are
+// members[offsets[c]..offsets[c+1])), mapping members through aindex.
+// Exits with status 2 if the file cannot be created.
+void write_cluster_file(const char *out_name, cluster_format format,
+                        long long n_links, int n_iterations,
+                        int n_clusters, const int *offsets, const int *members,
+                        const int *aindex);
+
+// What clout_ana2 derives from a cluster file: clusters of more than one
+// member, their size histogram and the ids of the (first) largest one
+struct cluster_stats {
+    std::string name;           // cluster file the clusters would go to
+    long long n_links;
+    long long n_clusters;       // clusters of more than one member
+    int min_size, max_size;     // 0 without such clusters
+    double mean_size;
+    std::vector<long long> histogram;   // number of clusters of every size
+    std::vector<int> largest;
+};
+
+// Statistics of the clusters in CSR form, as write_cluster_file() takes them
+void compute_cluster_stats(cluster_stats *st, int n_clusters, const int *offsets,
+                           const int *members, const int *aindex);
+
+// A cluster file written one cluster at a time, for clusterings that are
+// never whole in memory (--slabs). The ids of a cluster may come in several
+// pieces. The text and uncompressed layouts need the counts (or offsets)
+// before the ids, so their ids wait in <out_name>.part until
+// close_cluster_stream() writes the header. With CLUSTER_STATS_ONLY no file
+// is written; the statistics go to *stats instead.
+struct cluster_stream {
+    cluster_format format;
+    FILE *f;
+    FILE *part;                 // ids waiting for the header (text, uncompressed)
+    std::string part_name;
+    long long n_clusters, n_members;
+    int64_t prev;               // last id of the current cluster (deltas)
+    uint64_t payload_bytes;
+    std::vector<uint8_t> buffer;
+    cluster_stats *stats;
+    long long stats_members;    // members of the clusters counted in *stats
+    bool in_largest;            // the current cluster is of the largest size so far
+    bool larger;                // and larger than stats->largest
+    std::vector<int> candidate; // its ids
+};
+
+// Exits with status 2 if the file cannot be created, like write_cluster_file()
+void open_cluster_stream(cluster_stream *w, const char *out_name, cluster_format format,
+                         cluster_stats *stats = NULL);
+
+// Starts the next cluster, of size members given by write_stream_ids()
+void begin_stream_cluster(cluster_stream *w, long long size);
+
+void write_stream_ids(cluster_stream *w, const int *ids, long long count);
+
+// Writes the header and closes the file
+void close_cluster_stream(cluster_stream *w, long long n_links, int n_iterations);
+
+// Sequential reader over a memory-mapped cluster file of either format
+struct cluster_reader {
+    const char *data;           // mapping of the whole file
+    size_t size;
+    bool binary;
+    cluster_file_header header;
+    long long n_links;
+    long long n_clusters;       // -1 if not known (text file without header)
+    long long next;             // index of the next cluster
+    size_t pos;                 // byte cursor (text and compressed payload)
+    std::vector<int> buffer;    // decoded ids of the current cluster
+};
+
+bool open_cluster_file(const char *path, cluster_reader *r);
+
+// Fetches the next cluster; *ids stays valid until the next call.
+// Returns false after the last cluster.
+bool next_cluster(cluster_reader *r, const int **ids, int *count);
+
+void close_cluster_file(cluster_reader *r);
+
+#endif // CLUSTER_IO_H
@@ -1,18 +1,150 @@
 #ifndef CLUSTERING_H
 #define CLUSTERING_H
 
+#include <vector>
+#include "timing.h"
+#include "cluster_io.h"
+#include "union_find.h"
+#include "arena.h"
+
+// Pair search used by the neighboring*() functions
+enum neighbor_engine {
+    NEIGHBOR_BRUTE_FORCE,   // all pairs m < n, O(N^2) reference
+    NEIGHBOR_CELL_LIST      // linked cells of edge >= cut-off, O(N) at fixed density
+};
+
+// OpenMP scheduling of the pair-search loops (--schedule). The all-pairs
+// loop over m < n is triangular and needs dynamic or guided scheduling
+// to balance; chunk <= 0 selects the OpenMP default chunk.
+enum pair_schedule {
+    SCHEDULE_STATIC,
+    SCHEDULE_DYNAMIC,
+    SCHEDULE_GUIDED
+};
+
+void set_pair_schedule(pair_schedule kind, int chunk);
+
+// Format of the cluster files written by neighboring*() (default text)
+void set_cluster_format(cluster_format format);
+
+// With CLUSTER_STATS_ONLY, the neighboring*() functions called from this
+// thread append the statistics of every selection to *sink (NULL: none)
+void set_cluster_stats_sink(std::vector<cluster_stats> *sink);
+
+// Components of the contact graph are tracked with a union-find forest
+// (see union_find.h); the "iterations for convergence" field of the output
+// is therefore always 1.
+
 // Modified Clustering Algorithm for Molecular Simulation
 // By: Fellipe Carvalho de Oliveira - COPPE/PEQ/UFRJ
-void neighboring(float **rx, float **ry, float **rz,
-                 float dist_cluster, int n_molecules,
-                 int max_contacts,  float Lx, float Ly, float Lz, int n_parti_per_molecule, int* aindex, const char *out_name);
+//
+// Clusters molecules: two molecules are linked when any of their particles
+// are closer than dist_cluster. The particles of molecule m are
+// [mol_start[m], mol_start[m+1]) of rx/ry/rz, so molecule sizes may vary.
+// Contacts are searched between particles and merged per molecule.
+// aindex[m] is the id written for molecule m.
+// Scratch buffers of the neighboring*() functions come from arena if given.
+void neighboring(const float *rx, const float *ry, const float *rz,
+                 float dist_cluster, int n_molecules, const int *mol_start,
+                 float Lx, float Ly, float Lz, int *aindex, const char *out_name,
+                 bool use_pbc, int dimensions = 3,
+                 neighbor_engine engine = NEIGHBOR_CELL_LIST,
+                 phase_timings *timings = NULL, frame_arena *arena = NULL);
 
 // The same algorithm like neighboring() but for particles (instead of molecules)
 void neighboring_particles(float *rx, float *ry, float *rz,
                                 float dist_cluster, int n_particles,
-                                int max_contacts, 
                                 float Lx, float Ly, float Lz, 
                                 int *aindex, const char *out_name,
-                                bool use_pbc);
+                                bool use_pbc, int dimensions = 3,
+                                neighbor_engine engine = NEIGHBOR_CELL_LIST,
+                                phase_timings *timings = NULL, frame_arena *arena = NULL);
+
+// neighboring_particles() for several disjoint selections of one frame
+// (types, layers) sharing a single spatial index and one traversal.
+// Selection g is [sel_start[g], sel_start[g+1]) of rx/ry/rz/aindex and is
+// written to out_names[g]; selections with a NULL name are skipped.
+// Only particles of the same selection are ever linked.
+void neighboring_selections(const float *rx, const float *ry, const float *rz,
+                            float dist_cluster, int n_selections, const int *sel_start,
+                            float Lx, float Ly, float Lz,
+                            int *aindex, const char *const *out_names,
+                            bool use_pbc, int dimensions = 3,
+                            neighbor_engine engine = NEIGHBOR_CELL_LIST,
+                            phase_timings *timings = NULL, frame_arena *arena = NULL);
+
+// Writes the clusters of every named selection from a forest over all the
+// particles of the selections (no component may cross two of them);
+// n_links[g] is the number of links of selection g
+void write_selection_clusters(concurrent_union_find *uf, const int *n_links,
+                              int n_selections, const int *sel_start,
+                              int *aindex, const char *const *out_names,
+                              phase_timings *timings = NULL, frame_arena *arena = NULL);
+
+// Pair searches of neighboring() and neighboring_selections() without the
+// output: *uf is initialised (free it with cuf_free()) and the linked
+// molecules / particles are merged in it. link_molecules() returns the
+// number of links; link_selections() counts those of selection g in
+// n_links[g] and skips the selections with a NULL name.
+int link_molecules(const float *rx, const float *ry, const float *rz,
+                   float dist_cluster, int n_molecules, const int *mol_start,
+                   float Lx, float Ly, float Lz,
+                   bool use_pbc, int dimensions, neighbor_engine engine,
+                   concurrent_union_find *uf, phase_timings *timings = NULL,
+                   frame_arena *arena = NULL);
+
+void link_selections(const float *rx, const float *ry, const float *rz,
+                     float dist_cluster, int n_selections, const int *sel_start,
+                     float Lx, float Ly, float Lz, const char *const *out_names,
+                     bool use_pbc, int dimensions, neighbor_engine engine,
+                     concurrent_union_find *uf, int *n_links,
+                     phase_timings *timings = NULL, frame_arena *arena = NULL);
+
+// Clusters of entries [first, first+n) of a forest whose components do not
+// leave that range: labels[i] is the cluster of entry first+i, numbered in
+// order of first appearance, and the entries of cluster c are
+// members[offsets[c]..offsets[c+1]) (ascending, relative to first).
+// labels and members hold n ints, offsets n+1. Returns the number of clusters.
+int cluster_labels(concurrent_union_find *uf, int first, int n, int *labels,
+                   int *offsets, int *members, frame_arena *arena = NULL);
+
+// Pair of distinct particles i, j of one selection closer than the cut-off
+struct selection_pair {
+    int selection;
+    float dist2;                // squared distance as the pair kernels round it
+    int i, j;
+};
+
+// Appends every pair within dist_cluster of each named selection to pairs
+// (in no particular order), using the same search as neighboring_selections()
+void find_selection_pairs(const float *rx, const float *ry, const float *rz,
+                          float dist_cluster, int n_selections, const int *sel_start,
+                          float Lx, float Ly, float Lz,
+                          const char *const *out_names,
+                          bool use_pbc, int dimensions,
+                          neighbor_engine engine,
+                          std::vector<selection_pair> *pairs,
+                          phase_timings *timings = NULL,
+                          frame_arena *arena = NULL);
+
+// Cluster statistics of the selections (as in neighboring_selections())
+// for many cut-offs from one neighbour search. The pairs within the
+// largest cut-off are collected once, sorted by distance and merged
+// Kruskal-style into a union-find while the cut-off grows. cutoffs must be
+// ascending; the links and clusters at each of them are exactly those of a
+// run with that cut-off. For every selection with a name, writes
+//   <name>.txt   one line per cut-off: links, clusters, and count, min,
+//                max and average size of the clusters of more than one
+//                member (as clout_ana2 reports them)
+//   <name>.hist  "cut size count" lines of the cluster-size distribution
+void sweep_selections(const float *rx, const float *ry, const float *rz,
+                      const float *cutoffs, int n_cutoffs,
+                      int n_selections, const int *sel_start,
+                      float Lx, float Ly, float Lz,
+                      const char *const *out_names,
+                      bool use_pbc, int dimensions = 3,
+                      neighbor_engine engine = NEIGHBOR_CELL_LIST,
+                      phase_timings *timings = NULL,
+                      frame_arena *arena = NULL);
 
 #endif // CLUSTERING_H
@@ -0,0 +1,118 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stddef.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "parser.h"
+#include "clustering.h"
+#include "timing.h"
+#include "verlet_list.h"
+#include "arena.h"
+
+// Settings shared by every snapshot of a run (from the command line)
+struct run_options {
+    std::vector<std::string> considered_types;
+    float cluster_cutoff;
+    std::vector<float> sweep_cutoffs;   // ascending; non-empty: statistics only
+    bool all;
+    bool up_layer;
+    bool down_layer;
+    bool molecules;             // cluster whole molecules (from the bonds)
+    bool use_pbc;
+    bool calc_com;
+    neighbor_engine engine;
+    float verlet_skin;          // > 0: reuse Verlet lists across snapshots
+    cluster_format format;      // of the per-selection cluster files
+                                // (CLUSTER_STATS_ONLY: --stats-only)
+    bool metrics;               // fill frame_result::metrics_line (--metrics)
+    int n_slabs;                // > 0: GSD frames are streamed and clustered
+                                // in slabs, never read whole (--slabs)
+};
+
+// One input snapshot: an XML file, or a frame of a GSD trajectory
+struct snapshot_source {
+    std::string file;
+    long long frame;            // -1 for an XML file
+};
+
+// Considered types and head/tail bond pairing of a topology, built once and
+// shared by the snapshots whose types and bonds did not change
+struct type_index {
+    std::vector<std::string> considered_types;  // opt.considered_types it was built for
+    std::vector<int> considered_id;  // type id of every considered type (-1 if absent)
+    std::vector<int> slot_of_type;   // first considered slot naming every type id (-1 if none)
+    // Bonds with an end of a considered type, in bond order (layer runs only):
+    // the end of that type (head), the other end (tail) and the slot
+    std::vector<int> bond_head, bond_tail, bond_slot;
+    // Molecules (--molecules only): their particles of a considered type,
+    // grouped by molecule, with the offsets and ids of the molecules that
+    // have any, out of n_molecules
+    int n_molecules = 0;
+    std::vector<int> mol_particles, mol_start, mol_id;
+};
+
+// One parsed snapshot of the input list
+struct snapshot {
+    size_t index;               // position in the input list
+    std::string file;
+    long long frame;            // frame of a GSD file, -1 for XML
+    std::string name;           // base name of the output files
+    int status;                 // 0 parsed, 1 file not found, 2 parse error
+    float *x, *y, *z;
+    float *vx, *vy, *vz;
+    int *ix, *iy, *iz;          // periodic images (<image>)
+    uint16_t *types;
+    std::vector<std::string> type_names;
+    bond *bonds;
+    int n_particles, n_bonds;
+    int capacity, bond_capacity;    // allocated lengths, kept when recycled
+    float lx, ly, lz, xy, xz, yz;
+    int dimensions;             // 2 or 3
+    std::shared_ptr<const type_index> tindex;   // NULL: built when processed
+    bool topology_reused;       // types and bonds taken from the topology cache
+    phase_timings timings;
+};
+
+// What processing a snapshot reports; emitted in input order
+struct frame_result {
+    size_t index;
+    std::string log;            // text for stdout
+    std::string errors;         // text for stderr
+    // Lines for the clusterfiles_* index of every considered type
+    // (empty when the snapshot was skipped). With --stats-only these are
+    // the rows of the .summary files, and the *_hist / *_largest rows go to
+    // the .hist and .largest_cluster files.
+    std::vector<std::string> all_lines, up_lines, down_lines;
+    std::vector<std::string> all_hist, up_hist, down_hist;
+    std::vector<std::string> all_largest, up_largest, down_largest;
+    std::string molecules_line; // for clusterfiles_molecules (--molecules)
+    std::string molecules_hist, molecules_largest;
+    bool verlet_used, verlet_rebuilt;
+    phase_timings timings;
+    std::string metrics_line;   // JSON object and newline (opt.metrics only)
+};
+
+// Empty snapshot without buffers
+void init_snapshot(snapshot *s);
+
+// Reads the source into s (s->status tells whether it succeeded). XML
+// snapshots go through the reader thread's topology cache. The buffers of
+// a snapshot read before are reused (grown if needed).
+void read_snapshot(const run_options &opt, size_t index, const snapshot_source &src,
+                   snapshot *s);
+
+std::shared_ptr<const type_index> build_type_index(const run_options &opt, const snapshot *s);
+
+// Partitions the snapshot by type / layer, clusters every selection and
+// writes the per-selection cluster files. With opt.verlet_skin > 0 the
+// per-type selections go through *verlet, which carries over to the next
+// snapshot processed with it. The scratch buffers of the frame come from
+// *arena, which is reset first (so buffers of the previous frame die here).
+void process_snapshot(const run_options &opt, snapshot *s, frame_result *r,
+                      verlet_list *verlet = NULL, frame_arena *arena = NULL);
+
+void free_snapshot(snapshot *s);
+
+#endif // FRAME_H
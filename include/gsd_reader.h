@@ -0,0 +1,113 @@
+#ifndef GSD_READER_H
+#define GSD_READER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "parser.h"
+
+// Reader for HOOMD GSD trajectories (file layout versions 1.x and 2.x).
+// The file is memory-mapped once; frames are read straight from the
+// mapped chunks into the per-particle arrays. Following the HOOMD schema,
+// a chunk missing from a frame (typically the topology: particles/types,
+// particles/typeid, bonds/*) is taken from frame 0, so it is stored and
+// read only once per trajectory.
+
+#define GSD_MAGIC 0x65DF65DF65DF65DFull
+
+struct gsd_file_header {
+    uint64_t magic;
+    uint64_t index_location;
+    uint64_t index_allocated_entries;
+    uint64_t namelist_location;
+    uint64_t namelist_allocated_entries;    // 64-byte entries before 2.0, bytes since
+    uint32_t schema_version;
+    uint32_t gsd_version;       // major << 16 | minor
+    char application[64];
+    char schema[64];
+    char reserved[80];
+};
+
+struct gsd_index_entry {
+    uint64_t frame;
+    uint64_t N;                 // rows
+    int64_t location;           // 0 for an unused entry
+    uint32_t M;                 // columns
+    uint16_t id;                // index into the name list
+    uint8_t type;               // gsd_type
+    uint8_t flags;
+};
+
+enum gsd_type {
+    GSD_TYPE_UINT8 = 1,
+    GSD_TYPE_UINT16,
+    GSD_TYPE_UINT32,
+    GSD_TYPE_UINT64,
+    GSD_TYPE_INT8,
+    GSD_TYPE_INT16,
+    GSD_TYPE_INT32,
+    GSD_TYPE_INT64,
+    GSD_TYPE_FLOAT,
+    GSD_TYPE_DOUBLE,
+    GSD_TYPE_CHARACTER
+};
+
+struct gsd_file {
+    const char *data;           // mapping of the whole file
+    size_t size;
+    gsd_file_header header;
+    std::vector<std::string> names;             // chunk name of every id
+    std::vector<const gsd_index_entry *> index; // valid entries by (frame, id)
+    std::vector<size_t> frame_start;            // n_frames+1 offsets into index
+    long long n_frames;
+};
+
+// Maps the file and indexes its chunks; false if it is not a GSD file
+bool open_gsd(const char *path, gsd_file *g);
+
+void close_gsd(gsd_file *g);
+
+// Size of the chunks stored in frame `frame` (without those taken from
+// frame 0)
+size_t gsd_frame_bytes(const gsd_file *g, long long frame);
+
+// Reads frame `frame` like parse_hoomd_xml() reads a snapshot: the arrays
+// are malloc'ed and owned by the caller, or reused as with the capacity
+// arguments of parse_hoomd_xml(). Returns 0 on success, 2 if the frame
+// does not exist or lacks positions.
+int read_gsd_frame(const gsd_file *g, long long frame,
+    float **x, float **y, float **z,
+    float **vx, float **vy, float **vz,
+    int **ix, int **iy, int **iz,
+    uint16_t **types, std::vector<std::string> *type_names,
+    int *n_particles,
+    bond **bonds, int *n_bonds,
+    float *lx, float *ly, float *lz,
+    float *xy, float *xz, float *yz,
+    int *dimensions,
+    int *capacity = NULL, int *bond_capacity = NULL);
+
+// Particles of one frame read block by block, for frames too large to
+// copy whole (--slabs). Only positions and types are read; the pages of
+// the mapping a block came from are dropped again, so the resident size
+// stays about that of one block however often the frame is scanned.
+struct gsd_particle_stream {
+    const gsd_file *g;
+    const gsd_index_entry *position;
+    const gsd_index_entry *typeid_;             // NULL: every particle has type 0
+    std::vector<uint16_t> type_of_row;          // particles/types row -> type id
+    long long n_particles;
+};
+
+// Opens frame `frame` for streaming; the type names, box lengths and
+// dimensions are read as by read_gsd_frame(). Returns 0, or 2 like it.
+int open_gsd_particles(const gsd_file *g, long long frame, gsd_particle_stream *ps,
+                       std::vector<std::string> *type_names,
+                       float *lx, float *ly, float *lz, int *dimensions);
+
+// Positions and type ids of the particles [first, first + count)
+void read_gsd_particles(const gsd_particle_stream *ps, long long first, int count,
+                        float *x, float *y, float *z, uint16_t *types);
+
+#endif // GSD_READER_H
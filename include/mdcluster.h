@@ -0,0 +1,66 @@
+#ifndef MDCLUSTER_H
+#define MDCLUSTER_H
+
+#include "arena.h"
+#include "clustering.h"
+
+// In-memory API of the mdcluster library: the clustering of hoomd_cluster2
+// (pair search, union-find, labelling) on positions the caller already
+// holds, e.g. in a HOOMD analyzer every N steps, without writing snapshots
+// or cluster files.
+
+// Box centred on the origin, as in HOOMD
+struct cluster_box {
+    float lx, ly, lz;
+    bool periodic;
+    int dimensions;             // 3, or 2 to search in the xy plane only
+};
+
+struct cluster_options {
+    float cutoff;
+    neighbor_engine engine;
+};
+
+// Labels and CSR membership of one clustering. The buffers are either the
+// caller's (wrap_cluster_result) or allocated by the library and reused,
+// grown when needed, by the next calls (init_cluster_result).
+struct cluster_result {
+    int n;                      // entries (particles or molecules) clustered
+    long long n_links;
+    int n_clusters;             // including clusters of a single entry
+    int *labels;                // [n] cluster of every entry, numbered in order of first appearance
+    int *offsets;               // [n_clusters + 1]
+    int *members;               // [n] entries of cluster c: members[offsets[c]..offsets[c+1]), ascending
+    int capacity;               // entries the buffers hold
+    bool owned;                 // buffers allocated by the library
+};
+
+// Empty result whose buffers the library allocates
+void init_cluster_result(cluster_result *r);
+
+// Result in caller-owned buffers of capacity entries (offsets: capacity+1)
+void wrap_cluster_result(cluster_result *r, int *labels, int *offsets, int *members, int capacity);
+
+// Frees the buffers allocated by the library (never the caller's)
+void free_cluster_result(cluster_result *r);
+
+// Clusters n particles: two are linked when closer than opt.cutoff.
+// Phase times and counters are added to *timings if given; scratch
+// buffers come from *arena if given, which is reset first.
+// Returns 0, or 1 if caller-owned buffers hold fewer than n entries.
+int cluster_particles(const float *x, const float *y, const float *z, int n,
+                      const cluster_box &box, const cluster_options &opt,
+                      cluster_result *r, phase_timings *timings = NULL,
+                      frame_arena *arena = NULL);
+
+// Clusters molecules: the particles of molecule m are
+// [mol_start[m], mol_start[m+1]) of x/y/z, and two molecules are linked
+// when any of their particles are closer than opt.cutoff.
+// Returns as cluster_particles().
+int cluster_molecules(const float *x, const float *y, const float *z,
+                      int n_molecules, const int *mol_start,
+                      const cluster_box &box, const cluster_options &opt,
+                      cluster_result *r, phase_timings *timings = NULL,
+                      frame_arena *arena = NULL);
+
+#endif // MDCLUSTER_H
@@ -0,0 +1,22 @@
+#ifndef MOLECULE_H
+#define MOLECULE_H
+
+#include "parser.h"
+
+// Molecules of a snapshot: the connected components of the <bond> graph.
+// Particles without bonds are molecules of their own. Positions stay in
+// the flat per-particle arrays; molecules are a CSR index over them, so
+// molecules of any size can be mixed.
+struct molecule_index {
+    int n_molecules;
+    int *molecule_of;        // molecule id of every particle
+    int *mol_start;          // n_molecules+1 offsets into mol_particles
+    int *mol_particles;      // particle indices grouped by molecule (ascending)
+};
+
+// Molecule ids are numbered by their lowest particle index
+void build_molecules(molecule_index *mi, int n_particles, const bond *bonds, int n_bonds);
+
+void free_molecules(molecule_index *mi);
+
+#endif // MOLECULE_H
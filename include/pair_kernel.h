@@ -0,0 +1,38 @@
+#ifndef PAIR_KERNEL_H
+#define PAIR_KERNEL_H
+
+// Batched minimum-image distance test used by the linked-cell search.
+// Kernels are specialised at compile time on periodic boundaries on/off
+// and on 2D/3D, use precomputed inverse box lengths (no divisions), and
+// come in scalar, AVX2 and AVX-512 flavours picked at runtime from what
+// the CPU supports.
+
+struct pair_box {
+    float L[3];         // box lengths
+    float inv_L[3];     // 1 / L
+    float cut2;         // squared cut-off
+};
+
+// Tests the candidates [begin, end) of the arrays xs/ys/zs against the
+// point (x, y, z); writes the indices of those closer than the cut-off to
+// hits (room for end - begin entries) and returns how many there are.
+typedef int (*pair_kernel)(float x, float y, float z,
+                           const float *xs, const float *ys, const float *zs,
+                           int begin, int end, const pair_box *box, int *hits);
+
+void init_pair_box(pair_box *box, float Lx, float Ly, float Lz, float dist_cluster);
+
+// Squared distance between (x, y, z) and candidate b, rounded exactly as
+// in the kernels (so it is < box->cut2 precisely for the reported hits)
+float pair_kernel_dist2(float x, float y, float z,
+                        const float *xs, const float *ys, const float *zs,
+                        int b, const pair_box *box, bool use_pbc, int dimensions);
+
+// Best kernel for this CPU
+pair_kernel select_pair_kernel(bool use_pbc, int dimensions);
+
+// Instruction set of the kernels select_pair_kernel() returns:
+// "avx512", "avx2" or "scalar"
+const char *pair_kernel_isa();
+
+#endif // PAIR_KERNEL_H
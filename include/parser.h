@@ -1,19 +1,61 @@
 #ifndef PARSER_H
 #define PARSER_H
 
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Particle types are interned: every particle carries a type id indexing
+// the type-name table returned by the parser.
+#define MAX_PARTICLE_TYPES 65535
+
+// Bond "<typei>-<typej> ai aj"; the type names are interned in the same table
 struct sbond {
     int ai, aj;
-    char typei[9], typej[9];
+    uint16_t typei, typej;
 };
 
 typedef sbond bond;
 
+// Particle types and bonds of a trajectory, which do not change between its
+// snapshots. Once cached, the <type> and <bond> blocks of later snapshots
+// are only hashed, not tokenized; the cached arrays are copied when the
+// hashes and the particle count match, and the file is parsed in full
+// (refreshing the cache) otherwise.
+struct topology {
+    bool valid;
+    bool reused;                // the last parse took it from the cache
+    int n_particles, n_bonds;
+    bool has_bonds;
+    uint64_t type_hash, bond_hash;  // FNV-1a of the <type> / <bond> text
+    std::vector<std::string> type_names;
+    uint16_t *types;
+    bond *bonds;
+};
+
+void init_topology(topology *topo);
+
+void free_topology(topology *topo);
+
+// Initialises libxml2; call once before parsing from several threads
+void init_parser();
+
+// Missing <velocity> and <image> entries are returned as zeros; so is
+// <image> when read_images is false. With topo, the types and bonds come
+// from / are stored in that cache. With capacity (and bond_capacity), the
+// arrays passed in are reused and only grown with realloc, for buffers
+// recycled between snapshots; the caller then owns them even on failure.
 int parse_hoomd_xml(const char *filename,
     float **x, float **y, float **z,
     float **vx, float **vy, float **vz,
-    char ***types, int *n_particles,
+    int **ix, int **iy, int **iz,
+    uint16_t **types, std::vector<std::string> *type_names,
+    int *n_particles,
     bond **bonds, int *n_bonds,
     float *lx, float *ly, float *lz,
-    float *xy, float *xz, float *yz);
+    float *xy, float *xz, float *yz,
+    int *dimensions,
+    topology *topo = NULL, bool read_images = true,
+    int *capacity = NULL, int *bond_capacity = NULL);
 
 #endif // PARSER_H
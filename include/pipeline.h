@@ -0,0 +1,28 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <functional>
+#include <string>
+#include <vector>
+#include "frame.h"
+
+// Pipelined batch processing of a list of snapshots.
+// n_readers threads parse the snapshots into a bounded queue of at most
+// queue_depth frames; n_workers threads take frames from the queue and
+// cluster them concurrently (each with threads_per_worker OpenMP threads).
+// emit() is called for every snapshot strictly in input order, one call at a
+// time. At most queue_depth + n_readers + n_workers frames are in memory;
+// their buffers are recycled from frame to frame, and every worker clusters
+// in its own frame_arena.
+struct pipeline_options {
+    int n_readers;
+    int n_workers;
+    int queue_depth;
+    int threads_per_worker;
+};
+
+void run_pipeline(const run_options &opt, const pipeline_options &popt,
+                  const std::vector<snapshot_source> &sources,
+                  const std::function<void(frame_result &)> &emit);
+
+#endif // PIPELINE_H
@@ -0,0 +1,54 @@
+#ifndef SLAB_CLUSTERING_H
+#define SLAB_CLUSTERING_H
+
+#include <string>
+#include <vector>
+#include "clustering.h"
+#include "gsd_reader.h"
+
+// Out-of-core clustering of GSD frames larger than memory (--slabs).
+// The box is cut into slabs along its longest axis, each at least one
+// cut-off thick, and the particles are streamed from the mapped file once
+// per slab, so only one slab is held in memory at a time. A slab is
+// clustered on its own; clusters with a member within the cut-off of a
+// slab face get a provisional label, and only those members (the boundary
+// layers) are kept. When the next slab is done, the pairs across the face
+// the two share merge provisional labels in a union-find, and so do the
+// pairs across the periodic wrap after the last slab. Interior clusters
+// are written as soon as their slab is done; the members of the others
+// wait in a scratch file until all slabs are merged.
+//
+// The clusters and links are those of the in-memory clustering; the
+// clusters come in a different order, and the members of a cluster
+// spanning several slabs are ordered by slab.
+
+struct slab_options {
+    float cutoff;
+    int n_slabs;                // requested (fewer if thinner than the cut-off)
+    bool use_pbc;
+    neighbor_engine engine;
+    cluster_format format;
+};
+
+struct slab_report {
+    int n_slabs;                // used
+    int axis;                   // 0, 1, 2 for x, y, z
+    long long n_particles;      // of the frame
+    long long max_slab;         // most particles held in memory at once
+    long long n_boundary;       // clusters touching a slab face
+    std::vector<long long> n_selected, n_links, n_clusters;    // per selection
+};
+
+// Clusters the particles of type types[g] (selection g) of GSD frame
+// `frame`, writing selection g to out_names[g] (NULL: not clustered) in
+// opt.format. With CLUSTER_STATS_ONLY the statistics of every named
+// selection are appended to *stats instead. The members of boundary
+// clusters are kept in the file scratch_name meanwhile. Returns 0, or 2
+// if the frame cannot be read.
+int cluster_gsd_slabs(const gsd_file *g, long long frame, const slab_options &opt,
+                      const std::vector<std::string> &types, const char *const *out_names,
+                      const std::string &scratch_name, std::vector<cluster_stats> *stats,
+                      slab_report *report, phase_timings *timings = NULL,
+                      frame_arena *arena = NULL);
+
+#endif // SLAB_CLUSTERING_H
@@ -0,0 +1,53 @@
+#ifndef SYNTHETIC_SYSTEMS_H
+#define SYNTHETIC_SYSTEMS_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "parser.h"
+
+// Synthetic snapshots for the benchmarks (cluster_bench). Every system is
+// generated deterministically from a seed in a periodic box centred on the
+// origin, like the HOOMD snapshots, at roughly the requested size.
+enum synthetic_kind {
+    SYNTHETIC_GAS,          // uniform random A particles, number density 0.1
+    SYNTHETIC_LIQUID,       // A particles on a jittered lattice, density 0.85
+    SYNTHETIC_CHAINS,       // random-walk A chains of 100 bonded beads that
+                            // span the box, density 0.5
+    SYNTHETIC_BILAYER,      // A-T-T molecules (head A, tails T) in two
+                            // leaflets around z = 0, as in test/
+    N_SYNTHETIC_KINDS
+};
+
+struct synthetic_system {
+    synthetic_kind kind;
+    int n_particles;
+    float *x, *y, *z;
+    uint16_t *types;
+    std::vector<std::string> type_names;
+    bond *bonds;
+    int n_bonds;
+    float lx, ly, lz;
+};
+
+// "gas", "liquid", "chains", "bilayer"
+const char *synthetic_name(synthetic_kind kind);
+
+// Kind named name; false if there is none
+bool synthetic_from_name(const char *name, synthetic_kind *kind);
+
+// About n particles (rounded to whole molecules / lattice sites)
+void generate_system(synthetic_system *s, synthetic_kind kind, int n, uint64_t seed);
+
+// Renumbers the particles in a random order (bonds follow), as the tags of
+// a long simulation are spread over the box; the generators number them
+// along the lattice or chain, i.e. almost in space order
+void shuffle_system(synthetic_system *s, uint64_t seed);
+
+// Writes s as a HOOMD XML snapshot (position, image, type, bond blocks).
+// Returns false if the file cannot be written.
+bool write_hoomd_xml(const synthetic_system *s, const char *path);
+
+void free_system(synthetic_system *s);
+
+#endif // SYNTHETIC_SYSTEMS_H
@@ -0,0 +1,87 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stdio.h>
+#include <string>
+
+// Phases of processing one snapshot
+enum phase {
+    PHASE_PARSE,        // reading the XML file
+    PHASE_PARTITION,    // splitting particles by type / layer
+    PHASE_PAIRS,        // neighbour search and union-find merging
+    PHASE_CLUSTERS,     // component labels, dense ids, CSR membership
+    PHASE_OUTPUT,       // writing the cluster files
+    N_PHASES
+};
+
+// Counters of the hot paths, collected along with the phase times
+enum counter {
+    COUNT_BYTES_PARSED,     // input bytes of the snapshot
+    COUNT_PAIRS_TESTED,     // candidate pairs given to the distance tests
+    COUNT_LINKS,            // links written to the cluster files
+    COUNT_UNIONS,           // union-find merges of two components
+    COUNT_LABEL_ITERATIONS, // label passes (one per clustered selection)
+    COUNT_CLUSTERS,
+    N_COUNTERS
+};
+
+// Threads with their own slot in the per-thread work; higher thread
+// numbers share the last slot
+#define MAX_METRIC_THREADS 64
+
+struct phase_timings {
+    double seconds[N_PHASES];
+    long long counts[N_COUNTERS];
+    // Pair-search work of every OpenMP thread
+    int n_threads;              // highest thread number seen + 1
+    long long thread_pairs[MAX_METRIC_THREADS];
+    double thread_seconds[MAX_METRIC_THREADS];
+};
+
+// Adds the elapsed time to one phase when it goes out of scope
+// (nothing if t is NULL)
+struct scoped_phase {
+    phase_timings *t;
+    phase p;
+    double t0;
+    scoped_phase(phase_timings *t, phase p);
+    ~scoped_phase();
+};
+
+// Monotonic wall-clock time in seconds
+double wall_time();
+
+void reset_timings(phase_timings *t);
+
+// t += other
+void add_timings(phase_timings *t, const phase_timings *other);
+
+// Work of one thread in a pair-search region; call once per thread at
+// the end of the region (thread-safe, nothing if t is NULL)
+void add_thread_work(phase_timings *t, int thread, long long pairs, double seconds);
+
+// Slowest thread over the mean of the threads in the pair search
+// (1 = balanced, 0 if there was no threaded work)
+double thread_imbalance(const phase_timings *t);
+
+// One line "label parse 0.01 s partition ... total ... s\n"
+std::string format_timings(const char *label, const phase_timings *t);
+
+void print_timings(FILE *f, const char *label, const phase_timings *t);
+
+// Fields of a JSON object for the metrics files, without braces:
+// "seconds": {...}, "counts": {...}, "thread_pairs": [...], ...
+std::string format_metrics_json(const phase_timings *t);
+
+// Peak resident set size of the process so far (since the last
+// reset_peak_rss()), in kB
+long peak_rss_kb();
+
+// Resident set size of the process now, in kB (-1 if unknown)
+long current_rss_kb();
+
+// Restarts the peak of peak_rss_kb() from the current resident set size
+// (Linux /proc/self/clear_refs); false if the kernel does not support it
+bool reset_peak_rss();
+
+#endif // TIMING_H
@@ -0,0 +1,45 @@
+#ifndef UNION_FIND_H
+#define UNION_FIND_H
+
+#include <atomic>
+#include "arena.h"
+
+// Disjoint-set forest with path compression and union by rank.
+// Components of the contact graph are merged as links are found, so no
+// adjacency lists and no iterative label propagation are needed.
+struct union_find {
+    int n;
+    int *parent;
+    int *rank;
+    frame_arena *arena;         // owner of parent and rank (NULL: malloc)
+};
+
+void uf_init(union_find *uf, int n, frame_arena *arena = NULL);
+
+// Root of the set containing i (compresses the path on the way)
+int uf_find(union_find *uf, int i);
+
+// Merges the sets of i and j; returns true if they were disjoint
+bool uf_union(union_find *uf, int i, int j);
+
+void uf_free(union_find *uf);
+
+// Lock-free variant for concurrent merging from many threads.
+// Roots are linked with compare-and-swap, always the larger index under the
+// smaller one (so no cycles can form without ranks), and finds use path
+// halving. Safe to call cuf_find()/cuf_union() from any number of threads.
+struct concurrent_union_find {
+    int n;
+    std::atomic<int> *parent;
+    frame_arena *arena;         // owner of parent (NULL: malloc)
+};
+
+void cuf_init(concurrent_union_find *uf, int n, frame_arena *arena = NULL);
+
+int cuf_find(concurrent_union_find *uf, int i);
+
+bool cuf_union(concurrent_union_find *uf, int i, int j);
+
+void cuf_free(concurrent_union_find *uf);
+
+#endif // UNION_FIND_H
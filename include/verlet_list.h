@@ -0,0 +1,50 @@
+#ifndef VERLET_LIST_H
+#define VERLET_LIST_H
+
+#include "clustering.h"
+#include "timing.h"
+
+// Verlet neighbour list kept across the snapshots of a trajectory
+// (--verlet <skin>). It holds every pair of the same selection closer than
+// cut-off + skin when it was built, so it stays complete while no particle
+// has moved more than skin/2 since then: a frame then only filters the
+// list by the cut-off. Displacements are measured on positions unwrapped
+// with the <image> counts. The list is rebuilt when a particle moved too
+// far, or when the box, the cut-off or the selections changed.
+struct verlet_list {
+    float skin;
+    bool built;
+    // State of the last build
+    float cutoff;
+    float L[3];
+    int n_selections;
+    int n_particles;
+    int *sel_start;             // n_selections+1 selection offsets
+    int *aindex;                // particle of every selection entry
+    float *x0, *y0, *z0;        // unwrapped positions of the entries
+    int *pair_start;            // n_particles+1 offsets into pair_j
+    int *pair_j;                // partners of every entry within cut-off + skin
+    // Statistics
+    long long n_frames, n_builds;
+};
+
+void init_verlet_list(verlet_list *vl, float skin);
+
+void free_verlet_list(verlet_list *vl);
+
+// neighboring_selections() through the Verlet list. Entry e of the
+// selections is particle aindex[e] of the snapshot; ix/iy/iz are the
+// images of the snapshot's particles. Returns true if the list was rebuilt.
+// Per-frame scratch buffers come from arena if given; the list itself is
+// always on the heap since it outlives the frame.
+bool verlet_selections(verlet_list *vl,
+                       const float *rx, const float *ry, const float *rz,
+                       const int *ix, const int *iy, const int *iz,
+                       float dist_cluster, int n_selections, const int *sel_start,
+                       float Lx, float Ly, float Lz,
+                       int *aindex, const char *const *out_names,
+                       bool use_pbc, int dimensions = 3,
+                       neighbor_engine engine = NEIGHBOR_CELL_LIST,
+                       phase_timings *timings = NULL, frame_arena *arena = NULL);
+
+#endif // VERLET_LIST_H
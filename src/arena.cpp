@@ -0,0 +1,91 @@
+#include <stdlib.h>
+#include "arena.h"
+
+#define ARENA_ALIGN 64
+
+struct arena_spill {
+    arena_spill *next;
+};
+
+static size_t align_up(size_t n)
+{
+    return (n + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+void init_arena(frame_arena *a)
+{
+    a->base = NULL;
+    a->capacity = a->used = 0;
+    a->spills = NULL;
+    a->n_spills = 0;
+    a->frame_bytes = a->peak_bytes = 0;
+    a->n_grows = 0;
+}
+
+static void free_spills(frame_arena *a)
+{
+    while (a->spills)
+    {
+        arena_spill *next = a->spills->next;
+        free(a->spills);
+        a->spills = next;
+    }
+}
+
+void free_arena(frame_arena *a)
+{
+    free_spills(a);
+    free(a->base);
+    init_arena(a);
+}
+
+void arena_reset(frame_arena *a)
+{
+    if (a->spills)
+    {
+        // The last frame did not fit: one block for all of it from now on,
+        // with some headroom for frames that vary in size
+        free_spills(a);
+        free(a->base);
+        a->capacity = align_up(a->peak_bytes + a->peak_bytes / 8);
+        a->base = (char *)aligned_alloc(ARENA_ALIGN, a->capacity);
+        if (!a->base)
+            a->capacity = 0;
+        a->n_grows++;
+    }
+    a->used = 0;
+    a->n_spills = 0;
+    a->frame_bytes = 0;
+}
+
+void *arena_alloc(frame_arena *a, size_t bytes)
+{
+    if (!a)
+        return malloc(bytes > 0 ? bytes : 1);
+
+    bytes = align_up(bytes > 0 ? bytes : 1);
+    a->frame_bytes += bytes;
+    if (a->frame_bytes > a->peak_bytes)
+        a->peak_bytes = a->frame_bytes;
+    if (a->used + bytes <= a->capacity)
+    {
+        void *p = a->base + a->used;
+        a->used += bytes;
+        return p;
+    }
+
+    // Header padded to the alignment so the payload stays aligned
+    arena_spill *s = (arena_spill *)aligned_alloc(ARENA_ALIGN, ARENA_ALIGN + bytes);
+    if (!s)
+        return NULL;
+    s->next = a->spills;
+    a->spills = s;
+    a->n_spills++;
+    return (char *)s + ARENA_ALIGN;
+}
+
+void arena_release(frame_arena *a, void *p)
+{
+    if (!a)
+        free(p);
+}
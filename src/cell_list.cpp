@@ -0,0 +1,395 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include "cell_list.h"
+
+static cell_order current_order = CELL_ORDER_ROW_MAJOR;
+
+void set_cell_order(cell_order order)
+{
+    current_order = order;
+}
+
+// Number of cells of edge >= dist_cluster that fit in a length L
+static int cells_along(float L, float dist_cluster)
+{
+    if (!(L > 0) || !(dist_cluster > 0))
+        return 1;
+    int n = (int)floorf(L / dist_cluster);
+    return n < 1 ? 1 : n;
+}
+
+// Cell coordinate of r in a region [r0, r0 + n*c), wrapped when periodic
+static int cell_coord(float r, float r0, float c, int n, bool use_pbc)
+{
+    if (n == 1)
+        return 0;
+    float t = (r - r0) / (n * c);
+    if (use_pbc)
+        t -= floorf(t);
+    int k = (int)(t * n);
+    if (k < 0)
+        k = 0;
+    if (k >= n)
+        k = n - 1;
+    return k;
+}
+
+// Position of point k along the curve through a grid of 2^bits points per
+// side in dims dimensions (k is overwritten)
+static uint64_t curve_index(cell_order order, unsigned *k, int dims, int bits)
+{
+    if (order == CELL_ORDER_HILBERT)
+    {
+        // Skilling's transform of the coordinates into the transposed
+        // Hilbert index (AIP Conf. Proc. 707, 381 (2004))
+        unsigned top = 1u << (bits - 1);
+        for (unsigned q = top; q > 1; q >>= 1)
+        {
+            unsigned p = q - 1;
+            for (int i = 0; i < dims; i++)
+            {
+                if (k[i] & q)
+                    k[0] ^= p;
+                else
+                {
+                    unsigned t = (k[0] ^ k[i]) & p;
+                    k[0] ^= t;
+                    k[i] ^= t;
+                }
+            }
+        }
+        for (int i = 1; i < dims; i++)
+            k[i] ^= k[i - 1];
+        unsigned t = 0;
+        for (unsigned q = top; q > 1; q >>= 1)
+            if (k[dims - 1] & q)
+                t ^= q - 1;
+        for (int i = 0; i < dims; i++)
+            k[i] ^= t;
+    }
+
+    // Interleaved bits, most significant first (the Morton code as is)
+    uint64_t index = 0;
+    for (int b = bits - 1; b >= 0; b--)
+        for (int i = 0; i < dims; i++)
+            index = (index << 1) | ((k[i] >> b) & 1);
+    return index;
+}
+
+// Rows (ky, kz) of an ny x nz grid of rows in curve order. It depends on
+// the grid only and is kept per thread, so the frames of a trajectory
+// compute it once.
+static const int *curve_rows(cell_order order, int ny, int nz)
+{
+    thread_local std::vector<int> rows;
+    thread_local int grid[3] = {-1, -1, -1};
+    if (grid[0] == (int)order && grid[1] == ny && grid[2] == nz)
+        return rows.data();
+
+    int bits = 1;
+    while ((1 << bits) < std::max(ny, nz))
+        bits++;
+
+    std::vector<std::pair<uint64_t, int> > keyed((size_t)ny * nz);
+    for (int kz = 0; kz < nz; kz++)
+        for (int ky = 0; ky < ny; ky++)
+        {
+            unsigned k[2] = {(unsigned)ky, (unsigned)kz};
+            keyed[kz * ny + ky] = std::make_pair(curve_index(order, k, 2, bits), kz * ny + ky);
+        }
+    std::sort(keyed.begin(), keyed.end());
+
+    rows.resize(keyed.size());
+    for (size_t r = 0; r < keyed.size(); r++)
+        rows[r] = keyed[r].second;
+    grid[0] = order;
+    grid[1] = ny;
+    grid[2] = nz;
+    return rows.data();
+}
+
+void build_cell_list(cell_list *cl,
+                     const float *rx, const float *ry, const float *rz,
+                     int n_particles, float dist_cluster,
+                     float Lx, float Ly, float Lz, bool use_pbc,
+                     int dimensions, const int *keys, int n_keys,
+                     frame_arena *arena)
+{
+    cl->arena = arena;
+    cl->use_pbc = use_pbc;
+    cl->n_keys = keys ? n_keys : 1;
+
+    float ex, ey, ez;
+    if (use_pbc)
+    {
+        // HOOMD boxes are centred at the origin
+        cl->x0 = -0.5f * Lx;
+        cl->y0 = -0.5f * Ly;
+        cl->z0 = -0.5f * Lz;
+        ex = Lx;
+        ey = Ly;
+        ez = Lz;
+    }
+    else
+    {
+        float xmin = 0, xmax = 0, ymin = 0, ymax = 0, zmin = 0, zmax = 0;
+        if (n_particles > 0)
+        {
+            xmin = xmax = rx[0];
+            ymin = ymax = ry[0];
+            zmin = zmax = rz[0];
+        }
+        for (int i = 1; i < n_particles; i++)
+        {
+            xmin = fminf(xmin, rx[i]); xmax = fmaxf(xmax, rx[i]);
+            ymin = fminf(ymin, ry[i]); ymax = fmaxf(ymax, ry[i]);
+            zmin = fminf(zmin, rz[i]); zmax = fmaxf(zmax, rz[i]);
+        }
+        cl->x0 = xmin;
+        cl->y0 = ymin;
+        cl->z0 = zmin;
+        ex = xmax - xmin;
+        ey = ymax - ymin;
+        ez = zmax - zmin;
+    }
+
+    cl->nx = cells_along(ex, dist_cluster);
+    cl->ny = cells_along(ey, dist_cluster);
+    cl->nz = dimensions == 2 ? 1 : cells_along(ez, dist_cluster);
+
+    // Sparse systems in large boxes: coarsen the grid so the number of
+    // cells stays proportional to the number of particles
+    long max_cells = 4L * (n_particles > 0 ? n_particles : 1) + 27;
+    while ((long)cl->nx * cl->ny * cl->nz > max_cells)
+    {
+        if (cl->nx >= cl->ny && cl->nx >= cl->nz)
+            cl->nx = (cl->nx + 1) / 2;
+        else if (cl->ny >= cl->nz)
+            cl->ny = (cl->ny + 1) / 2;
+        else
+            cl->nz = (cl->nz + 1) / 2;
+    }
+
+    cl->cx = ex > 0 ? ex / cl->nx : 1.0f;
+    cl->cy = ey > 0 ? ey / cl->ny : 1.0f;
+    cl->cz = ez > 0 ? ez / cl->nz : 1.0f;
+
+    int n_cells = cl->nx * cl->ny * cl->nz;
+
+    int n_rows = cl->ny * cl->nz;
+    cl->order = CELL_ORDER_ROW_MAJOR;
+    cl->rank_row = cl->row_rank = NULL;
+    if (current_order != CELL_ORDER_ROW_MAJOR && n_rows > 1)
+    {
+        cl->order = current_order;
+        cl->rank_row = arena_array<int>(arena, n_rows);
+        cl->row_rank = arena_array<int>(arena, n_rows);
+        memcpy(cl->rank_row, curve_rows(current_order, cl->ny, cl->nz), sizeof(int) * n_rows);
+        for (int r = 0; r < n_rows; r++)
+            cl->row_rank[cl->rank_row[r]] = r;
+    }
+
+    cl->cell_particles = arena_array<int>(arena, n_particles);
+    cl->particle_cell = arena_array<int>(arena, n_particles);
+    int *count = arena_array<int>(arena, n_cells + 1);
+    memset(count, 0, sizeof(int) * (n_cells + 1));
+    for (int i = 0; i < n_particles; i++)
+    {
+        int kx = cell_coord(rx[i], cl->x0, cl->cx, cl->nx, use_pbc);
+        int ky = cell_coord(ry[i], cl->y0, cl->cy, cl->ny, use_pbc);
+        int kz = cell_coord(rz[i], cl->z0, cl->cz, cl->nz, use_pbc);
+        int row = kz * cl->ny + ky;
+        int c = (cl->row_rank ? cl->row_rank[row] : row) * cl->nx + kx;
+        cl->particle_cell[i] = c;
+        count[c + 1]++;
+    }
+
+    // Radix sort of the particles by (key, cell): a counting sort by cell,
+    // then a stable one by key, so neither pass has n_keys*n_cells buckets
+    for (int c = 0; c < n_cells; c++)
+        count[c + 1] += count[c];
+    bool keyed = keys && cl->n_keys > 1;
+    int *by_cell = keyed ? arena_array<int>(arena, n_particles) : cl->cell_particles;
+    for (int i = 0; i < n_particles; i++)
+        by_cell[count[cl->particle_cell[i]]++] = i;
+    if (keyed)
+    {
+        int *key_fill = arena_array<int>(arena, cl->n_keys + 1);
+        memset(key_fill, 0, sizeof(int) * (cl->n_keys + 1));
+        for (int i = 0; i < n_particles; i++)
+            key_fill[keys[i] + 1]++;
+        for (int g = 0; g < cl->n_keys; g++)
+            key_fill[g + 1] += key_fill[g];
+        for (int k = 0; k < n_particles; k++)
+            cl->cell_particles[key_fill[keys[by_cell[k]]]++] = by_cell[k];
+        arena_release(arena, key_fill);
+        arena_release(arena, by_cell);
+    }
+
+    // The non-empty runs, and the runs of every cell
+    cl->n_runs = 0;
+    for (int k = 0; k < n_particles; k++)
+    {
+        int i = cl->cell_particles[k], j = k > 0 ? cl->cell_particles[k - 1] : -1;
+        if (k == 0 || cl->particle_cell[i] != cl->particle_cell[j] || (keyed && keys[i] != keys[j]))
+            cl->n_runs++;
+    }
+    cl->run_start = arena_array<int>(arena, (size_t)cl->n_runs + 1);
+    cl->run_key = arena_array<int>(arena, cl->n_runs);
+    cl->run_cell = arena_array<int>(arena, cl->n_runs);
+    cl->cell_run_start = arena_array<int>(arena, (size_t)n_cells + 1);
+    cl->cell_runs = arena_array<int>(arena, cl->n_runs);
+    memset(cl->cell_run_start, 0, sizeof(int) * (n_cells + 1));
+    int run = -1;
+    for (int k = 0; k < n_particles; k++)
+    {
+        int i = cl->cell_particles[k], key = keyed ? keys[i] : 0;
+        if (run < 0 || cl->particle_cell[i] != cl->run_cell[run] || key != cl->run_key[run])
+        {
+            run++;
+            cl->run_start[run] = k;
+            cl->run_key[run] = key;
+            cl->run_cell[run] = cl->particle_cell[i];
+            cl->cell_run_start[cl->particle_cell[i] + 1]++;
+        }
+    }
+    cl->run_start[cl->n_runs] = n_particles;
+    for (int c = 0; c < n_cells; c++)
+        cl->cell_run_start[c + 1] += cl->cell_run_start[c];
+    memcpy(count, cl->cell_run_start, sizeof(int) * n_cells);
+    for (int r = 0; r < cl->n_runs; r++)
+        cl->cell_runs[count[cl->run_cell[r]]++] = r;
+    arena_release(arena, count);
+
+    // Contiguous copies of the positions so each cell can be scanned in batches
+    cl->xs = arena_array<float>(arena, n_particles);
+    cl->ys = arena_array<float>(arena, n_particles);
+    cl->zs = arena_array<float>(arena, n_particles);
+    for (int k = 0; k < n_particles; k++)
+    {
+        int i = cl->cell_particles[k];
+        cl->xs[k] = rx[i];
+        cl->ys[k] = ry[i];
+        cl->zs[k] = rz[i];
+    }
+}
+
+// Cell offsets to visit along one dimension of n cells, without duplicates
+static int stencil(int k, int n, bool use_pbc, int *coords)
+{
+    int count = 0;
+    if (use_pbc)
+    {
+        // With fewer than 3 cells, -1 and +1 wrap onto the same cell
+        int lo = n >= 3 ? -1 : 0;
+        int hi = n >= 2 ? 1 : 0;
+        for (int d = lo; d <= hi; d++)
+            coords[count++] = ((k + d) % n + n) % n;
+    }
+    else
+    {
+        for (int d = -1; d <= 1; d++)
+            if (k + d >= 0 && k + d < n)
+                coords[count++] = k + d;
+    }
+    return count;
+}
+
+int cell_neighbours(const cell_list *cl, int cell, int *neighbours)
+{
+    int kx = cell % cl->nx;
+    int row = cell / cl->nx;
+    if (cl->rank_row)
+        row = cl->rank_row[row];
+    int ky = row % cl->ny;
+    int kz = row / cl->ny;
+
+    int sx[3], sy[3], sz[3];
+    int nsx = stencil(kx, cl->nx, cl->use_pbc, sx);
+    int nsy = stencil(ky, cl->ny, cl->use_pbc, sy);
+    int nsz = stencil(kz, cl->nz, cl->use_pbc, sz);
+
+    int count = 0;
+    if (cl->rank_row)
+    {
+        // Neighbour rows in curve order, each row ascending along x
+        int ranks[9], n_ranks = 0;
+        for (int a = 0; a < nsz; a++)
+            for (int b = 0; b < nsy; b++)
+            {
+                int rank = cl->row_rank[sz[a] * cl->ny + sy[b]], k = n_ranks++;
+                for (; k > 0 && ranks[k - 1] > rank; k--)
+                    ranks[k] = ranks[k - 1];
+                ranks[k] = rank;
+            }
+        std::sort(sx, sx + nsx);
+        for (int a = 0; a < n_ranks; a++)
+            for (int c = 0; c < nsx; c++)
+                neighbours[count++] = ranks[a] * cl->nx + sx[c];
+        return count;
+    }
+
+    for (int a = 0; a < nsz; a++)
+        for (int b = 0; b < nsy; b++)
+            for (int c = 0; c < nsx; c++)
+                neighbours[count++] = (sz[a] * cl->ny + sy[b]) * cl->nx + sx[c];
+    return count;
+}
+
+int neighbour_ranges(const cell_list *cl, int key, int cell, int *range_begin, int *range_end)
+{
+    int neighbours[27];
+    int n_neighbours = cell_neighbours(cl, cell, neighbours);
+    int n_ranges = 0;
+    for (int c = 0; c < n_neighbours; c++)
+    {
+        // The run of key in that cell, if any (a cell has few runs)
+        int run = -1;
+        for (int k = cl->cell_run_start[neighbours[c]]; k < cl->cell_run_start[neighbours[c] + 1]; k++)
+            if (cl->run_key[cl->cell_runs[k]] >= key)
+            {
+                if (cl->run_key[cl->cell_runs[k]] == key)
+                    run = cl->cell_runs[k];
+                break;
+            }
+        if (run < 0)
+            continue;
+        int begin = cl->run_start[run], end = cl->run_start[run + 1];
+        if (n_ranges > 0 && range_end[n_ranges - 1] == begin)
+        {
+            range_end[n_ranges - 1] = end;
+            continue;
+        }
+        range_begin[n_ranges] = begin;
+        range_end[n_ranges++] = end;
+    }
+    return n_ranges;
+}
+
+void free_cell_list(cell_list *cl)
+{
+    arena_release(cl->arena, cl->rank_row);
+    arena_release(cl->arena, cl->row_rank);
+    arena_release(cl->arena, cl->run_start);
+    arena_release(cl->arena, cl->run_key);
+    arena_release(cl->arena, cl->run_cell);
+    arena_release(cl->arena, cl->cell_run_start);
+    arena_release(cl->arena, cl->cell_runs);
+    arena_release(cl->arena, cl->cell_particles);
+    arena_release(cl->arena, cl->particle_cell);
+    arena_release(cl->arena, cl->xs);
+    arena_release(cl->arena, cl->ys);
+    arena_release(cl->arena, cl->zs);
+    cl->xs = cl->ys = cl->zs = NULL;
+    cl->run_start = cl->run_key = cl->run_cell = NULL;
+    cl->cell_run_start = cl->cell_runs = NULL;
+    cl->cell_particles = NULL;
+    cl->particle_cell = NULL;
+    cl->rank_row = cl->row_rank = NULL;
+}
@@ -0,0 +1,530 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include "cluster_io.h"
+
+static void put_varint(std::vector<uint8_t> &out, uint64_t v)
+{
+    while (v >= 0x80)
+    {
+        out.push_back((uint8_t)(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back((uint8_t)v);
+}
+
+static bool get_varint(const char *data, size_t size, size_t *pos, uint64_t *v)
+{
+    uint64_t result = 0;
+    for (int shift = 0; shift < 64 && *pos < size; shift += 7)
+    {
+        uint8_t b = (uint8_t)data[(*pos)++];
+        result |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80))
+        {
+            *v = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+static uint64_t zigzag(int64_t v)
+{
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static int64_t unzigzag(uint64_t v)
+{
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static FILE *create_file(const char *out_name)
+{
+    FILE *f = fopen(out_name, "wb");
+    if (!f) {
+        printf("ERROR: enable to create file %s\n",out_name);
+        exit(2);
+    }
+    return f;
+}
+
+static void write_text(const char *out_name, long long n_links, int n_iterations,
+                       int n_clusters, const int *offsets, const int *members,
+                       const int *aindex)
+{
+    FILE *f = create_file(out_name);
+
+    fprintf(f, "Numbers of Links %lld\n", n_links);
+    fprintf(f, "Number of clusters %d\n", n_clusters);
+    fprintf(f, "Number of iterations for convergence %d\n\n", n_iterations);
+    for (int i = 0; i < n_clusters; i++)
+    {
+        fprintf(f, "Cluster : %d\n", i + 1);
+        fprintf(f, "Molecules (%d):\n", offsets[i + 1] - offsets[i]);
+        for (int k = offsets[i]; k < offsets[i + 1]; k++)
+            fprintf(f, "%d\n", aindex[members[k]]);
+    }
+    fclose(f);
+}
+
+static void init_header(cluster_file_header *h, bool compress, long long n_links, int n_iterations,
+                        long long n_clusters, long long n_members, uint64_t payload_bytes)
+{
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, CLUSTER_FILE_MAGIC, sizeof(CLUSTER_FILE_MAGIC));
+    h->version = CLUSTER_FILE_VERSION;
+    h->flags = compress ? CLUSTER_FLAG_COMPRESSED : 0;
+    h->n_links = n_links;
+    h->n_clusters = n_clusters;
+    h->n_members = n_members;
+    h->n_iterations = n_iterations;
+    h->payload_bytes = payload_bytes;
+}
+
+static void write_binary(const char *out_name, bool compress, long long n_links,
+                         int n_iterations, int n_clusters, const int *offsets,
+                         const int *members, const int *aindex)
+{
+    cluster_file_header h;
+    init_header(&h, compress, n_links, n_iterations, n_clusters, offsets[n_clusters], 0);
+
+    FILE *f = create_file(out_name);
+
+    if (compress)
+    {
+        std::vector<uint8_t> payload;
+        payload.reserve(h.n_members * 2 + n_clusters);
+        for (int i = 0; i < n_clusters; i++)
+        {
+            put_varint(payload, offsets[i + 1] - offsets[i]);
+            int64_t prev = 0;
+            for (int k = offsets[i]; k < offsets[i + 1]; k++)
+            {
+                int64_t id = aindex[members[k]];
+                put_varint(payload, zigzag(id - prev));
+                prev = id;
+            }
+        }
+        h.payload_bytes = payload.size();
+        fwrite(&h, sizeof(h), 1, f);
+        fwrite(payload.data(), 1, payload.size(), f);
+    }
+    else
+    {
+        h.payload_bytes = sizeof(uint64_t) * (n_clusters + 1) + sizeof(int32_t) * h.n_members;
+        fwrite(&h, sizeof(h), 1, f);
+        for (int i = 0; i <= n_clusters; i++)
+        {
+            uint64_t off = offsets[i];
+            fwrite(&off, sizeof(off), 1, f);
+        }
+        std::vector<int32_t> ids(h.n_members);
+        for (int64_t k = 0; k < h.n_members; k++)
+            ids[k] = aindex[members[k]];
+        fwrite(ids.data(), sizeof(int32_t), ids.size(), f);
+    }
+    fclose(f);
+}
+
+void write_cluster_file(const char *out_name, cluster_format format,
+                        long long n_links, int n_iterations,
+                        int n_clusters, const int *offsets, const int *members,
+                        const int *aindex)
+{
+    if (format == CLUSTER_TEXT)
+        write_text(out_name, n_links, n_iterations, n_clusters, offsets, members, aindex);
+    else
+        write_binary(out_name, format == CLUSTER_BINARY_COMPRESSED, n_links, n_iterations,
+                     n_clusters, offsets, members, aindex);
+}
+
+void compute_cluster_stats(cluster_stats *st, int n_clusters, const int *offsets,
+                           const int *members, const int *aindex)
+{
+    long long total = 0;
+    int largest = -1;
+    st->n_clusters = st->min_size = st->max_size = 0;
+    st->histogram.clear();
+    for (int c = 0; c < n_clusters; c++)
+    {
+        int size = offsets[c + 1] - offsets[c];
+        if (size < 2)
+            continue;
+        if ((size_t)size >= st->histogram.size())
+            st->histogram.resize(size + 1, 0);
+        st->histogram[size]++;
+        if (st->n_clusters == 0 || size < st->min_size)
+            st->min_size = size;
+        if (st->n_clusters == 0 || size > st->max_size)
+        {
+            st->max_size = size;
+            largest = c;
+        }
+        total += size;
+        st->n_clusters++;
+    }
+    st->mean_size = st->n_clusters > 0 ? (double)total / st->n_clusters : 0.0;
+    st->largest.clear();
+    if (largest >= 0)
+        for (int k = offsets[largest]; k < offsets[largest + 1]; k++)
+            st->largest.push_back(aindex[members[k]]);
+}
+
+// Appends the rest of `from` (rewound) to `to`
+static void append_file(FILE *to, FILE *from)
+{
+    std::vector<char> block(1 << 20);
+    rewind(from);
+    size_t n;
+    while ((n = fread(block.data(), 1, block.size(), from)) > 0)
+        fwrite(block.data(), 1, n, to);
+}
+
+void open_cluster_stream(cluster_stream *w, const char *out_name, cluster_format format,
+                         cluster_stats *stats)
+{
+    w->format = format;
+    w->f = w->part = NULL;
+    w->part_name.clear();
+    w->n_clusters = w->n_members = 0;
+    w->prev = 0;
+    w->payload_bytes = 0;
+    w->buffer.clear();
+    w->stats = stats;
+    w->stats_members = 0;
+    w->in_largest = w->larger = false;
+    w->candidate.clear();
+
+    if (format == CLUSTER_STATS_ONLY)
+    {
+        stats->name = out_name;
+        stats->n_clusters = stats->min_size = stats->max_size = 0;
+        stats->histogram.clear();
+        stats->largest.clear();
+        return;
+    }
+    w->f = create_file(out_name);
+    if (format != CLUSTER_BINARY_COMPRESSED)
+    {
+        w->part_name = std::string(out_name) + ".part";
+        w->part = fopen(w->part_name.c_str(), "w+b");
+        if (!w->part) {
+            printf("ERROR: enable to create file %s\n", w->part_name.c_str());
+            exit(2);
+        }
+    }
+    if (format != CLUSTER_TEXT)
+    {
+        // Placeholder, rewritten once the counts are known
+        cluster_file_header h;
+        init_header(&h, false, 0, 0, 0, 0, 0);
+        fwrite(&h, sizeof(h), 1, w->f);
+    }
+}
+
+// Ends the current cluster of a stats-only stream. Of two clusters of the
+// largest size the one with the lower lowest id is kept, as it is the
+// first of them in memory (clusters are numbered by their lowest member).
+static void settle_largest(cluster_stream *w)
+{
+    if (!w->in_largest)
+        return;
+    std::vector<int> &largest = w->stats->largest;
+    if (w->larger || (!w->candidate.empty() &&
+                      *std::min_element(w->candidate.begin(), w->candidate.end()) <
+                      *std::min_element(largest.begin(), largest.end())))
+        largest.swap(w->candidate);
+    w->candidate.clear();
+    w->in_largest = false;
+}
+
+void begin_stream_cluster(cluster_stream *w, long long size)
+{
+    w->prev = 0;
+    if (w->format == CLUSTER_TEXT)
+    {
+        fprintf(w->part, "Cluster : %lld\n", w->n_clusters + 1);
+        fprintf(w->part, "Molecules (%lld):\n", size);
+    }
+    else if (w->format == CLUSTER_BINARY)
+    {
+        uint64_t off = w->n_members;
+        fwrite(&off, sizeof(off), 1, w->f);
+    }
+    else if (w->format == CLUSTER_BINARY_COMPRESSED)
+        put_varint(w->buffer, size);
+    else if (size >= 2)
+    {
+        cluster_stats *st = w->stats;
+        if ((size_t)size >= st->histogram.size())
+            st->histogram.resize(size + 1, 0);
+        st->histogram[size]++;
+        settle_largest(w);
+        if (st->n_clusters == 0 || size < st->min_size)
+            st->min_size = size;
+        w->larger = st->n_clusters == 0 || size > st->max_size;
+        w->in_largest = w->larger || size == st->max_size;
+        if (w->larger)
+            st->max_size = size;
+        w->stats_members += size;
+        st->n_clusters++;
+    }
+    else
+        settle_largest(w);
+    w->n_clusters++;
+    w->n_members += size;
+}
+
+void write_stream_ids(cluster_stream *w, const int *ids, long long count)
+{
+    switch (w->format)
+    {
+    case CLUSTER_TEXT:
+        for (long long k = 0; k < count; k++)
+            fprintf(w->part, "%d\n", ids[k]);
+        break;
+    case CLUSTER_BINARY:
+        fwrite(ids, sizeof(int32_t), count, w->part);
+        break;
+    case CLUSTER_BINARY_COMPRESSED:
+        for (long long k = 0; k < count; k++)
+        {
+            put_varint(w->buffer, zigzag(ids[k] - w->prev));
+            w->prev = ids[k];
+        }
+        if (w->buffer.size() >= (1 << 20))
+        {
+            fwrite(w->buffer.data(), 1, w->buffer.size(), w->f);
+            w->payload_bytes += w->buffer.size();
+            w->buffer.clear();
+        }
+        break;
+    case CLUSTER_STATS_ONLY:
+        if (w->in_largest)
+            w->candidate.insert(w->candidate.end(), ids, ids + count);
+        break;
+    }
+}
+
+void close_cluster_stream(cluster_stream *w, long long n_links, int n_iterations)
+{
+    if (w->format == CLUSTER_STATS_ONLY)
+    {
+        settle_largest(w);
+        w->stats->n_links = n_links;
+        w->stats->mean_size = w->stats->n_clusters > 0 ? (double)w->stats_members / w->stats->n_clusters : 0.0;
+        // Ascending like the members of a cluster in memory, whatever order
+        // its pieces came in
+        std::sort(w->stats->largest.begin(), w->stats->largest.end());
+        return;
+    }
+
+    cluster_file_header h;
+    if (w->format == CLUSTER_TEXT)
+    {
+        fprintf(w->f, "Numbers of Links %lld\n", n_links);
+        fprintf(w->f, "Number of clusters %lld\n", w->n_clusters);
+        fprintf(w->f, "Number of iterations for convergence %d\n\n", n_iterations);
+        append_file(w->f, w->part);
+    }
+    else if (w->format == CLUSTER_BINARY)
+    {
+        uint64_t off = w->n_members;
+        fwrite(&off, sizeof(off), 1, w->f);
+        append_file(w->f, w->part);
+        init_header(&h, false, n_links, n_iterations, w->n_clusters, w->n_members,
+                    sizeof(uint64_t) * (w->n_clusters + 1) + sizeof(int32_t) * w->n_members);
+    }
+    else
+    {
+        fwrite(w->buffer.data(), 1, w->buffer.size(), w->f);
+        w->payload_bytes += w->buffer.size();
+        w->buffer.clear();
+        init_header(&h, true, n_links, n_iterations, w->n_clusters, w->n_members, w->payload_bytes);
+    }
+    if (w->format != CLUSTER_TEXT)
+    {
+        fseek(w->f, 0, SEEK_SET);
+        fwrite(&h, sizeof(h), 1, w->f);
+    }
+    fclose(w->f);
+    w->f = NULL;
+    if (w->part)
+    {
+        fclose(w->part);
+        remove(w->part_name.c_str());
+        w->part = NULL;
+    }
+}
+
+bool open_cluster_file(const char *path, cluster_reader *r)
+{
+    r->data = NULL;
+    r->size = 0;
+    r->next = 0;
+    r->pos = 0;
+    r->n_links = 0;
+    r->n_clusters = -1;
+    r->buffer.clear();
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return false;
+    }
+    r->size = st.st_size;
+    if (r->size > 0)
+    {
+        void *p = mmap(NULL, r->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED)
+        {
+            close(fd);
+            return false;
+        }
+        madvise(p, r->size, MADV_SEQUENTIAL);
+        r->data = (const char *)p;
+    }
+    close(fd);
+
+    r->binary = r->size >= sizeof(cluster_file_header) &&
+                !memcmp(r->data, CLUSTER_FILE_MAGIC, sizeof(CLUSTER_FILE_MAGIC));
+    if (r->binary)
+    {
+        memcpy(&r->header, r->data, sizeof(r->header));
+        const cluster_file_header &h = r->header;
+        bool valid = h.version == CLUSTER_FILE_VERSION &&
+                     h.payload_bytes <= r->size - sizeof(h) &&
+                     h.n_clusters >= 0 && h.n_members >= 0;
+        // The ids are returned straight from the mapping: the offsets and
+        // ids must fill the payload exactly
+        if (valid && !(h.flags & CLUSTER_FLAG_COMPRESSED))
+            valid = (uint64_t)h.n_clusters < h.payload_bytes / sizeof(uint64_t) &&
+                    (uint64_t)h.n_members <= h.payload_bytes / sizeof(int32_t) &&
+                    sizeof(uint64_t) * (h.n_clusters + 1) + sizeof(int32_t) * h.n_members == h.payload_bytes;
+        if (!valid)
+        {
+            close_cluster_file(r);
+            return false;
+        }
+        r->n_links = r->header.n_links;
+        r->n_clusters = r->header.n_clusters;
+        r->pos = sizeof(r->header);
+    }
+    else
+    {
+        const char *marker = "Numbers of Links ";
+        size_t len = strlen(marker);
+        if (r->size > len && !memcmp(r->data, marker, len))
+            r->n_links = atoll(std::string(r->data + len, r->data + std::min(r->size, len + 24)).c_str());
+    }
+    return true;
+}
+
+// Line [begin, end) at *pos, advancing *pos past its newline
+static bool next_line(const cluster_reader *r, size_t *pos, const char **begin, const char **end)
+{
+    if (*pos >= r->size)
+        return false;
+    *begin = r->data + *pos;
+    const char *nl = (const char *)memchr(*begin, '\n', r->size - *pos);
+    *end = nl ? nl : r->data + r->size;
+    *pos = (*end - r->data) + (nl ? 1 : 0);
+    return true;
+}
+
+static bool next_text_cluster(cluster_reader *r, const int **ids, int *count)
+{
+    static const char marker[] = "Molecules (";
+    const size_t marker_len = sizeof(marker) - 1;
+    const char *begin, *end;
+
+    while (next_line(r, &r->pos, &begin, &end))
+    {
+        const char *m = (size_t)(end - begin) >= marker_len ?
+            (const char *)memmem(begin, end - begin, marker, marker_len) : NULL;
+        if (!m)
+            continue;
+        char *after;
+        long n = strtol(m + marker_len, &after, 10);
+        if (after == m + marker_len || after >= end || *after != ')')
+            continue;
+
+        // Ids that do not parse are skipped, like the original analysis
+        r->buffer.clear();
+        for (long i = 0; i < n && next_line(r, &r->pos, &begin, &end); i++)
+        {
+            char *stop;
+            long id = strtol(begin, &stop, 10);
+            if (stop != begin)
+                r->buffer.push_back((int)id);
+        }
+        *ids = r->buffer.data();
+        *count = (int)r->buffer.size();
+        r->next++;
+        return true;
+    }
+    return false;
+}
+
+bool next_cluster(cluster_reader *r, const int **ids, int *count)
+{
+    if (!r->binary)
+        return next_text_cluster(r, ids, count);
+    if (r->next >= r->n_clusters)
+        return false;
+
+    const char *payload = r->data + sizeof(cluster_file_header);
+    if (r->header.flags & CLUSTER_FLAG_COMPRESSED)
+    {
+        size_t end = sizeof(cluster_file_header) + r->header.payload_bytes;
+        uint64_t n, delta;
+        // Each id takes at least one byte: a larger size is corrupt
+        if (!get_varint(r->data, end, &r->pos, &n) || n > end - r->pos || n > INT_MAX)
+            return false;
+        r->buffer.resize(n);
+        int64_t prev = 0;
+        for (uint64_t k = 0; k < n; k++)
+        {
+            if (!get_varint(r->data, end, &r->pos, &delta))
+                return false;
+            prev += unzigzag(delta);
+            r->buffer[k] = (int)prev;
+        }
+        *ids = r->buffer.data();
+        *count = (int)n;
+    }
+    else
+    {
+        // Zero-copy: the ids are returned straight from the mapping
+        const uint64_t *offsets = (const uint64_t *)payload;
+        const int32_t *members = (const int32_t *)(offsets + r->n_clusters + 1);
+        if (offsets[r->next] > offsets[r->next + 1] ||
+            offsets[r->next + 1] > (uint64_t)r->header.n_members)
+            return false;
+        *ids = members + offsets[r->next];
+        *count = (int)(offsets[r->next + 1] - offsets[r->next]);
+    }
+    r->next++;
+    return true;
+}
+
+void close_cluster_file(cluster_reader *r)
+{
+    if (r->data)
+        munmap((void *)r->data, r->size);
+    r->data = NULL;
+    r->size = 0;
+    r->buffer.clear();
+}
@@ -3,280 +3,774 @@
 #include <string.h>
 #include <math.h>
 #include <stdbool.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#ifdef _OPENMP
 #include <omp.h>
+#endif
+#include "cell_list.h"
+#include "pair_kernel.h"
+#include "union_find.h"
+#include "clustering.h"
+#include "timing.h"
+#include "cluster_io.h"
 
-void clustering(int **node_next, int *n_contacts_per_molecule,
-                int n_links, int n_molecules, int max_contacts,  int *aindex, const char *out_name)
+// Candidates handed to the distance kernel per call
+#define PAIR_BATCH 64
+
+static cluster_format output_format = CLUSTER_TEXT;
+
+void set_cluster_format(cluster_format format)
 {
-    int *nodeL = (int *)calloc(n_molecules, sizeof(int));
-    int *labels = (int *)calloc(max_contacts, sizeof(int));
-    int **clusters = (int **)malloc(n_molecules * sizeof(int *));
-    int *id = (int *)calloc(n_molecules, sizeof(int));
-    int *n_mol_per_cluster = (int *)calloc(n_molecules, sizeof(int));
-    for (int i = 0; i < n_molecules; i++) {
-        clusters[i] = (int *)calloc(n_molecules, sizeof(int));
-        for (int j = 0; j < n_molecules; j++)
-            clusters[i][j] = -1;
-        nodeL[i] = -1;
-        id[i] = -1;
-    }
+    output_format = format;
+}
 
-    int n_clusters = 0;
-    int tol = 1000, N = 1;
-    bool condition1 = true;
+static thread_local std::vector<cluster_stats> *stats_sink = NULL;
 
-    // Initial labeling
-    for (int i = 0; i < n_molecules; i++)
+void set_cluster_stats_sink(std::vector<cluster_stats> *sink)
+{
+    stats_sink = sink;
+}
+
+static pair_schedule schedule_kind = SCHEDULE_DYNAMIC;
+static int schedule_chunk = 64;
+
+void set_pair_schedule(pair_schedule kind, int chunk)
+{
+    schedule_kind = kind;
+    schedule_chunk = chunk;
+}
+
+// The pair loops use schedule(runtime); install the requested schedule
+// in the calling thread before entering them
+static void apply_pair_schedule()
+{
+#ifdef _OPENMP
+    omp_sched_t kind = omp_sched_dynamic;
+    if (schedule_kind == SCHEDULE_STATIC)
+        kind = omp_sched_static;
+    else if (schedule_kind == SCHEDULE_GUIDED)
+        kind = omp_sched_guided;
+    omp_set_schedule(kind, schedule_chunk);
+#endif
+}
+
+// Maps arbitrary labels in [0, n) to dense cluster ids 0..n_clusters-1,
+// numbered in order of first appearance. Returns n_clusters.
+static int relabel_dense(const int *label, int n, int *cluster_of, frame_arena *arena)
+{
+    int *dense = arena_array<int>(arena, n);
+    for (int i = 0; i < n; i++)
+        dense[i] = -1;
+
+    int n_clusters = 0;
+    for (int i = 0; i < n; i++)
     {
-        if (n_contacts_per_molecule[i] == 0)
-        {
-            nodeL[i] = n_clusters++;
-        }
-        else
-        {
-            for (int j = 0; j < max_contacts; j++)
-                labels[j] = -1;
-            for (int j = 0; j < n_contacts_per_molecule[i]; j++)
-                labels[j] = nodeL[node_next[i][j]];
+        if (dense[label[i]] < 0)
+            dense[label[i]] = n_clusters++;
+        cluster_of[i] = dense[label[i]];
+    }
+    arena_release(arena, dense);
+    return n_clusters;
+}
 
-            int max_val = -1;
-            for (int j = 0; j < n_contacts_per_molecule[i]; j++)
-                if (labels[j] > max_val)
-                    max_val = labels[j];
+// Counting sort of the members by cluster id into a CSR layout:
+// the members of cluster c are members[offsets[c]..offsets[c+1]), ascending.
+static void build_cluster_csr(const int *cluster_of, int n, int n_clusters,
+                              int *offsets, int *members, frame_arena *arena)
+{
+    for (int c = 0; c <= n_clusters; c++)
+        offsets[c] = 0;
+    for (int i = 0; i < n; i++)
+        offsets[cluster_of[i] + 1]++;
+    for (int c = 0; c < n_clusters; c++)
+        offsets[c + 1] += offsets[c];
 
-            if (max_val == -1)
-            {
-                nodeL[i] = n_clusters++;
-            }
-            else
-            {
-                int min_val = n_molecules + 1;
-                for (int j = 0; j < n_contacts_per_molecule[i]; j++)
-                    if (labels[j] > -1 && labels[j] < min_val)
-                        min_val = labels[j];
-                nodeL[i] = min_val;
-                for (int j = 0; j < n_contacts_per_molecule[i]; j++)
-                    nodeL[node_next[i][j]] = nodeL[i];
-            }
-        }
+    int *fill = arena_array<int>(arena, n_clusters);
+    memcpy(fill, offsets, sizeof(int) * n_clusters);
+    for (int i = 0; i < n; i++)
+        members[fill[cluster_of[i]]++] = i;
+    arena_release(arena, fill);
+}
+
+void clustering(const int *nodeL, int n_links, int n_molecules, int *aindex, const char *out_name,
+                phase_timings *timings, frame_arena *arena)
+{
+    double t0 = wall_time();
+
+    // Dense cluster ids and CSR membership: O(N) memory and time
+    int *cluster_of = arena_array<int>(arena, n_molecules);
+    int n_clusters = relabel_dense(nodeL, n_molecules, cluster_of, arena);
+
+    int *offsets = arena_array<int>(arena, n_clusters + 1);
+    int *members = arena_array<int>(arena, n_molecules);
+    build_cluster_csr(cluster_of, n_molecules, n_clusters, offsets, members, arena);
+
+    double t1 = wall_time();
+
+    // Components are exact after a single pass over the links
+    if (output_format != CLUSTER_STATS_ONLY)
+        write_cluster_file(out_name, output_format, n_links, 1, n_clusters, offsets, members, aindex);
+    else if (stats_sink)
+    {
+        stats_sink->emplace_back();
+        cluster_stats *st = &stats_sink->back();
+        st->name = out_name;
+        st->n_links = n_links;
+        compute_cluster_stats(st, n_clusters, offsets, members, aindex);
     }
 
-    while (N < tol && condition1)
+    if (timings)
     {
-        condition1 = false;
-        for (int i = 0; i < n_molecules; i++)
+        timings->seconds[PHASE_CLUSTERS] += t1 - t0;
+        timings->seconds[PHASE_OUTPUT] += wall_time() - t1;
+        timings->counts[COUNT_LINKS] += n_links;
+        timings->counts[COUNT_CLUSTERS] += n_clusters;
+        // Every merge removes one component
+        timings->counts[COUNT_UNIONS] += n_molecules - n_clusters;
+        timings->counts[COUNT_LABEL_ITERATIONS]++;
+    }
+
+    // Free memory
+    arena_release(arena, cluster_of);
+    arena_release(arena, offsets);
+    arena_release(arena, members);
+}
+
+static int thread_number()
+{
+#ifdef _OPENMP
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+}
+
+// Roots of the disjoint-set forest label the connected components
+static int *component_labels(concurrent_union_find *uf, int n, frame_arena *arena)
+{
+    int *nodeL = arena_array<int>(arena, n);
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < n; i++)
+        nodeL[i] = cuf_find(uf, i);
+    return nodeL;
+}
+
+int cluster_labels(concurrent_union_find *uf, int first, int n, int *labels,
+                   int *offsets, int *members, frame_arena *arena)
+{
+    int *root = arena_array<int>(arena, n);
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < n; i++)
+        root[i] = cuf_find(uf, first + i) - first;
+    int n_clusters = relabel_dense(root, n, labels, arena);
+    arena_release(arena, root);
+    build_cluster_csr(labels, n, n_clusters, offsets, members, arena);
+    return n_clusters;
+}
+
+// Squared minimum-image distance between particles m and n (pbc is 0 or 1).
+// Reference for the brute-force engines; the pair kernels agree with it.
+static inline float pair_dist2(const float *rx, const float *ry, const float *rz,
+                               int m, int n, int pbc, float Lx, float Ly, float Lz)
+{
+    float dx = rx[m] - rx[n];
+    dx -= pbc * Lx * rint(dx / Lx);
+    float dy = ry[m] - ry[n];
+    dy -= pbc * Ly * rint(dy / Ly);
+    float dz = rz[m] - rz[n];
+    dz -= pbc * Lz * rint(dz / Lz);
+    return dx * dx + dy * dy + dz * dz;
+}
+
+int link_molecules(const float *rx, const float *ry, const float *rz,
+                   float dist_cluster, int n_molecules, const int *mol_start,
+                   float Lx, float Ly, float Lz,
+                   bool use_pbc, int dimensions, neighbor_engine engine,
+                   concurrent_union_find *uf_out, phase_timings *timings, frame_arena *arena)
+{
+    double t0 = wall_time();
+    apply_pair_schedule();
+
+    int n_particles = mol_start[n_molecules];
+    int *molecule_of = arena_array<int>(arena, n_particles);
+    for (int m = 0; m < n_molecules; m++)
+        for (int i = mol_start[m]; i < mol_start[m + 1]; i++)
+            molecule_of[i] = m;
+
+    concurrent_union_find &uf = *uf_out;
+    cuf_init(&uf, n_molecules, arena);
+
+    // A link is a pair of molecules in contact, counted once however many
+    // of their particles touch
+    int n_links = 0;
+
+    int pbc = 0;
+    if (use_pbc) pbc = 1;
+
+    float dist2_cluster = dist_cluster * dist_cluster;
+
+    if (engine == NEIGHBOR_CELL_LIST)
+    {
+        cell_list cl;
+        build_cell_list(&cl, rx, ry, rz, n_particles, dist_cluster, Lx, Ly, Lz, use_pbc, dimensions,
+                        NULL, 1, arena);
+
+        pair_box box;
+        init_pair_box(&box, Lx, Ly, Lz, dist_cluster);
+        pair_kernel kernel = select_pair_kernel(use_pbc, dimensions);
+
+        int n_threads = 1;
+#ifdef _OPENMP
+        n_threads = omp_get_max_threads();
+#endif
+        int *seen_rows = arena_array<int>(arena, (size_t)n_threads * n_molecules);
+
+#pragma omp parallel num_threads(n_threads)
         {
-            if (n_contacts_per_molecule[i] != 0)
+            // seen[n] == m once the link m-n has been counted
+            int thread = thread_number();
+            double t_thread = wall_time();
+            long long tested = 0;
+            int *seen = seen_rows + (size_t)thread * n_molecules;
+            for (int n = 0; n < n_molecules; n++)
+                seen[n] = -1;
+            int hits[PAIR_BATCH];
+            int range_begin[27], range_end[27];
+
+#pragma omp for schedule(runtime) reduction(+ : n_links) nowait
+            for (int m = 0; m < n_molecules; m++)
             {
-                for (int j = 0; j < max_contacts; j++)
-                    labels[j] = -1;
-                for (int j = 0; j < n_contacts_per_molecule[i]; j++)
-                    labels[j] = nodeL[node_next[i][j]];
-                int min_val = n_molecules + 1;
-                for (int j = 0; j < n_contacts_per_molecule[i]; j++)
-                    if (labels[j] > -1 && labels[j] < min_val)
-                        min_val = labels[j];
-                nodeL[i] = min_val;
-                for (int j = 0; j < n_contacts_per_molecule[i]; j++)
-                    nodeL[node_next[i][j]] = nodeL[i];
+                for (int i = mol_start[m]; i < mol_start[m + 1]; i++)
+                {
+                    int n_ranges = neighbour_ranges(&cl, 0, cl.particle_cell[i], range_begin, range_end);
+                    for (int c = 0; c < n_ranges; c++)
+                    {
+                        int end = range_end[c];
+                        for (int begin = range_begin[c]; begin < end; begin += PAIR_BATCH)
+                        {
+                            int batch_end = begin + PAIR_BATCH < end ? begin + PAIR_BATCH : end;
+                            int n_hits = kernel(rx[i], ry[i], rz[i], cl.xs, cl.ys, cl.zs,
+                                                begin, batch_end, &box, hits);
+                            tested += batch_end - begin;
+                            for (int h = 0; h < n_hits; h++)
+                            {
+                                int n = molecule_of[cl.cell_particles[hits[h]]];
+                                if (n <= m || seen[n] == m)
+                                    continue;
+                                seen[n] = m;
+                                cuf_union(&uf, m, n);
+                                n_links++;
+                            }
+                        }
+                    }
+                }
             }
+            add_thread_work(timings, thread, tested, wall_time() - t_thread);
         }
 
-        // Check if labeling converged
-        for (int i = 0; i < n_molecules; i++)
+        arena_release(arena, seen_rows);
+        free_cell_list(&cl);
+    }
+    else
+    {
+#pragma omp parallel
         {
-            for (int j = 0; j < n_contacts_per_molecule[i]; j++)
-                labels[j] = nodeL[node_next[i][j]];
-            for (int j = 0; j < n_contacts_per_molecule[i]; j++)
+            double t_thread = wall_time();
+            long long tested = 0;
+#pragma omp for schedule(runtime) reduction(+ : n_links) nowait
+            for (int m = 0; m < n_molecules; m++)
             {
-                if (nodeL[i] != labels[j])
+                for (int n = m + 1; n < n_molecules; n++)
                 {
-                    condition1 = true;
-                    N++;
-                    goto exit_check;
+                    int found = 0;
+                    for (int i = mol_start[m]; i < mol_start[m + 1] && !found; i++)
+                    {
+                        for (int j = mol_start[n]; j < mol_start[n + 1]; j++)
+                        {
+                            tested++;
+                            if (pair_dist2(rx, ry, rz, i, j, pbc, Lx, Ly, Lz) < dist2_cluster)
+                            {
+                                cuf_union(&uf, m, n);
+                                n_links++;
+                                found = 1;
+                                break;
+                            }
+                        }
+                    }
                 }
             }
+            add_thread_work(timings, thread_number(), tested, wall_time() - t_thread);
         }
-    exit_check:;
     }
+    arena_release(arena, molecule_of);
 
-    // Recount clusters
-    n_clusters = 0;
-    for (int i = 0; i < n_molecules; i++)
-    {
-        bool condition2 = false, condition3 = true;
-        for (int j = i + 1; j < n_molecules; j++)
-            if (nodeL[i] == nodeL[j])
-                condition2 = true;
-        for (int j = i - 1; j >= 0; j--)
-            if (nodeL[i] == nodeL[j])
-                condition3 = false;
-
-        if (condition2 && condition3)
-        {
-            id[n_clusters++] = nodeL[i];
-        }
-        if (!condition2 && condition3)
-        {
-            id[n_clusters++] = nodeL[i];
-        }
-    }
+    if (timings)
+        timings->seconds[PHASE_PAIRS] += wall_time() - t0;
+    return n_links;
+}
 
-    for (int i = 0; i < n_clusters; i++)
+void neighboring(const float *rx, const float *ry, const float *rz,
+                 float dist_cluster, int n_molecules, const int *mol_start,
+                 float Lx, float Ly, float Lz, int *aindex, const char *out_name,
+                 bool use_pbc, int dimensions, neighbor_engine engine,
+                 phase_timings *timings, frame_arena *arena)
+{
+    concurrent_union_find uf;
+    int n_links = link_molecules(rx, ry, rz, dist_cluster, n_molecules, mol_start, Lx, Ly, Lz,
+                                 use_pbc, dimensions, engine, &uf, timings, arena);
+
+    int *nodeL;
     {
-        for (int j = 0; j < n_molecules; j++)
-        {
-            if (nodeL[j] == id[i])
-            {
-                clusters[i][j] = j;
-                n_mol_per_cluster[i]++;
-            }
-        }
+        scoped_phase timer(timings, PHASE_CLUSTERS);
+        nodeL = component_labels(&uf, n_molecules, arena);
+        cuf_free(&uf);
     }
 
-    FILE *f = fopen(out_name, "w");
+    clustering(nodeL, n_links, n_molecules, aindex, out_name, timings, arena);
 
-    if (!f) {
-        printf("ERROR: enable to create file %s\n",out_name);
-        exit(2);
+    arena_release(arena, nodeL);
+}
+
+void write_selection_clusters(concurrent_union_find *uf, const int *n_links,
+                              int n_selections, const int *sel_start,
+                              int *aindex, const char *const *out_names,
+                              phase_timings *timings, frame_arena *arena)
+{
+    int *nodeL;
+    {
+        scoped_phase timer(timings, PHASE_CLUSTERS);
+        nodeL = component_labels(uf, sel_start[n_selections], arena);
     }
-  
-    fprintf(f, "Numbers of Links %d\n", n_links);
-    fprintf(f, "Number of clusters %d\n", n_clusters);
-    fprintf(f, "Number of iterations for convergence %d\n\n", N);
-    for (int i = 0; i < n_clusters; i++)
+
+    for (int g = 0; g < n_selections; g++)
     {
-        fprintf(f, "Cluster : %d\n", i + 1);
-        fprintf(f, "Molecules (%d):\n", n_mol_per_cluster[i]);
-        for (int j = 0; j < n_molecules; j++)
-            if (clusters[i][j] > -1)
-                fprintf(f, "%d\n", aindex[clusters[i][j]]);
+        if (!out_names[g])
+            continue;
+        int begin = sel_start[g], count = sel_start[g + 1] - begin;
+        for (int i = begin; i < begin + count; i++)
+            nodeL[i] -= begin;
+        clustering(nodeL + begin, n_links[g], count, aindex + begin, out_names[g], timings, arena);
     }
-    fclose(f);
 
-    // Free memory
-    free(nodeL);
-    free(labels);
-    for (int i = 0; i < n_molecules; i++)
-        free(clusters[i]);
-    free(clusters);
-    free(id);
-    free(n_mol_per_cluster);
+    arena_release(arena, nodeL);
 }
 
-void neighboring(float **rx, float **ry, float **rz,
-                 float dist_cluster, int n_molecules,
-                 int max_contacts, float Lx, float Ly, float Lz, int n_parti_per_molecule,  int *aindex, const char *out_name)
+// Rewrites a forest over the sorted positions of a cell list as one over
+// the input indices: every particle then points straight at the input
+// index of its component's root
+static void unsort_forest(concurrent_union_find *uf, const int *cell_particles, frame_arena *arena)
 {
-    int **node_next = (int **)malloc(n_molecules * sizeof(int *));
-    int *n_contacts_per_molecule = (int *)calloc(n_molecules, sizeof(int));
-    for (int i = 0; i < n_molecules; i++)
-        node_next[i] = (int *)calloc(max_contacts, sizeof(int));
+    int n = uf->n;
+    int *root = arena_array<int>(arena, n);
+#pragma omp parallel for schedule(static)
+    for (int k = 0; k < n; k++)
+        root[k] = cuf_find(uf, k);
+#pragma omp parallel for schedule(static)
+    for (int k = 0; k < n; k++)
+        uf->parent[cell_particles[k]].store(cell_particles[root[k]], std::memory_order_relaxed);
+    arena_release(arena, root);
+}
 
-    int n_links = 0;
+void link_selections(const float *rx, const float *ry, const float *rz,
+                     float dist_cluster, int n_selections, const int *sel_start,
+                     float Lx, float Ly, float Lz, const char *const *out_names,
+                     bool use_pbc, int dimensions, neighbor_engine engine,
+                     concurrent_union_find *uf_out, int *n_links,
+                     phase_timings *timings, frame_arena *arena)
+{
+    double t0 = wall_time();
+    apply_pair_schedule();
 
-#pragma omp parallel for schedule(dynamic)
-    for (int m = 0; m < n_molecules; m++)
+    int n_particles = sel_start[n_selections];
+    int *selection_of = arena_array<int>(arena, n_particles);
+    for (int g = 0; g < n_selections; g++)
+        for (int i = sel_start[g]; i < sel_start[g + 1]; i++)
+            selection_of[i] = g;
+
+    // One forest for all selections; no link crosses two of them, so every
+    // component stays inside its selection's range
+    concurrent_union_find &uf = *uf_out;
+    cuf_init(&uf, n_particles, arena);
+
+    memset(n_links, 0, sizeof(int) * n_selections);
+
+    int pbc = 0;
+    if (use_pbc) pbc = 1;
+
+    float dist2_cluster = dist_cluster * dist_cluster;
+
+    if (engine == NEIGHBOR_CELL_LIST)
     {
-        for (int n = m + 1; n < n_molecules; n++)
+        cell_list cl;
+        build_cell_list(&cl, rx, ry, rz, n_particles, dist_cluster, Lx, Ly, Lz, use_pbc, dimensions,
+                        selection_of, n_selections, arena);
+
+        pair_box box;
+        init_pair_box(&box, Lx, Ly, Lz, dist_cluster);
+        pair_kernel kernel = select_pair_kernel(use_pbc, dimensions);
+
+        // The particles of one selection in one cell are a contiguous run of
+        // cl.xs/ys/zs, so a query is restricted to its own selection by
+        // looking up the runs of that selection only. Neighbour
+        // runs that follow each other in memory (consecutive cells along x)
+        // are tested in one kernel call. A pair is found from the lower of
+        // its two sorted positions only, which also skips the runs that lie
+        // entirely below. With the cells along a curve (--reorder) the
+        // forest is built over the sorted positions too, so its accesses
+        // follow the scan, and mapped back to the input indices afterwards.
+        bool sorted = cl.rank_row != NULL;
+#pragma omp parallel
         {
-            int found = 0;
-            for (int i = 0; i < n_parti_per_molecule && !found; i++)
+            double t_thread = wall_time();
+            long long tested = 0;
+#pragma omp for schedule(runtime) reduction(+ : n_links[:n_selections]) nowait
+            for (int run = 0; run < cl.n_runs; run++)
             {
-                for (int j = 0; j < n_parti_per_molecule; j++)
+                int hits[PAIR_BATCH];
+                int range_begin[27], range_end[27];
+                int g = cl.run_key[run];
+                if (!out_names[g])
+                    continue;
+                int n_ranges = neighbour_ranges(&cl, g, cl.run_cell[run], range_begin, range_end);
+                for (int a = cl.run_start[run]; a < cl.run_start[run + 1]; a++)
                 {
-                    float dx = rx[m][i] - rx[n][j];
-                    dx -= Lx * rint(dx / Lx);
-                    float dy = ry[m][i] - ry[n][j];
-                    dy -= Ly * rint(dy / Ly);
-                    float dz = rz[m][i] - rz[n][j];
-                    dz -= Lz * rint(dz / Lz);
-                    float dist2 = dx * dx + dy * dy + dz * dz;
-
-                    if (dist2 < dist_cluster * dist_cluster)
+                    int m = sorted ? a : cl.cell_particles[a];
+                    for (int c = 0; c < n_ranges; c++)
                     {
-#pragma omp critical
+                        int begin = range_begin[c] <= a ? a + 1 : range_begin[c];
+                        for (; begin < range_end[c]; begin += PAIR_BATCH)
                         {
-                            if (n_contacts_per_molecule[m] >= max_contacts || n_contacts_per_molecule[n] >= max_contacts)
-                            {
-                                fprintf(stderr, "Too many contacts!\n");
-                                exit(EXIT_FAILURE);
-                            }
-                            node_next[m][n_contacts_per_molecule[m]++] = n;
-                            node_next[n][n_contacts_per_molecule[n]++] = m;
-                            n_links++;
+                            int batch_end = begin + PAIR_BATCH < range_end[c] ? begin + PAIR_BATCH : range_end[c];
+                            int n_hits = kernel(cl.xs[a], cl.ys[a], cl.zs[a], cl.xs, cl.ys, cl.zs,
+                                                begin, batch_end, &box, hits);
+                            tested += batch_end - begin;
+                            for (int h = 0; h < n_hits; h++)
+                                cuf_union(&uf, m, sorted ? hits[h] : cl.cell_particles[hits[h]]);
+                            n_links[g] += n_hits;
                         }
-                        found = 1;
-                        break;
                     }
                 }
-                if (found)
-                    break;
             }
+            add_thread_work(timings, thread_number(), tested, wall_time() - t_thread);
+        }
+
+        if (sorted)
+            unsort_forest(&uf, cl.cell_particles, arena);
+        free_cell_list(&cl);
+    }
+    else
+    {
+#pragma omp parallel
+        {
+            double t_thread = wall_time();
+            long long tested = 0;
+#pragma omp for schedule(runtime) reduction(+ : n_links[:n_selections]) nowait
+            for (int m = 0; m < n_particles; m++)
+            {
+                int g = selection_of[m];
+                if (!out_names[g])
+                    continue;
+                tested += sel_start[g + 1] - (m + 1);
+                for (int n = m + 1; n < sel_start[g + 1]; n++)
+                {
+                    if (pair_dist2(rx, ry, rz, m, n, pbc, Lx, Ly, Lz) < dist2_cluster)
+                    {
+                        cuf_union(&uf, m, n);
+                        n_links[g]++;
+                    }
+                }
+            }
+            add_thread_work(timings, thread_number(), tested, wall_time() - t_thread);
         }
     }
+    arena_release(arena, selection_of);
+
+    if (timings)
+        timings->seconds[PHASE_PAIRS] += wall_time() - t0;
+}
 
-    clustering(node_next, n_contacts_per_molecule, n_links, n_molecules, max_contacts, aindex, out_name);
+void neighboring_selections(const float *rx, const float *ry, const float *rz,
+                            float dist_cluster, int n_selections, const int *sel_start,
+                            float Lx, float Ly, float Lz,
+                            int *aindex, const char *const *out_names,
+                            bool use_pbc, int dimensions, neighbor_engine engine,
+                            phase_timings *timings, frame_arena *arena)
+{
+    concurrent_union_find uf;
+    int *n_links = arena_array<int>(arena, n_selections);
+    link_selections(rx, ry, rz, dist_cluster, n_selections, sel_start, Lx, Ly, Lz, out_names,
+                    use_pbc, dimensions, engine, &uf, n_links, timings, arena);
 
-    for (int i = 0; i < n_molecules; i++)
-        free(node_next[i]);
-    free(node_next);
-    free(n_contacts_per_molecule);
+    write_selection_clusters(&uf, n_links, n_selections, sel_start, aindex, out_names, timings, arena);
+    cuf_free(&uf);
+    arena_release(arena, n_links);
 }
 
 void neighboring_particles(float *rx, float *ry, float *rz,
                            float dist_cluster, int n_particles,
-                           int max_contacts, float Lx, float Ly, float Lz, 
+                           float Lx, float Ly, float Lz, 
                            int *aindex, const char *out_name,
-                           bool use_pbc)
+                           bool use_pbc, int dimensions, neighbor_engine engine,
+                           phase_timings *timings, frame_arena *arena)
 {
-    int **node_next = (int **)malloc(n_particles * sizeof(int *));
-    int *n_contacts_per_molecule = (int *)calloc(n_particles, sizeof(int));
-    for (int i = 0; i < n_particles; i++)
-        node_next[i] = (int *)calloc(max_contacts, sizeof(int));
+    int sel_start[2] = {0, n_particles};
+    neighboring_selections(rx, ry, rz, dist_cluster, 1, sel_start, Lx, Ly, Lz,
+                           aindex, &out_name, use_pbc, dimensions, engine, timings, arena);
+}
 
-    int n_links = 0;
+static bool selection_pair_less(const selection_pair &a, const selection_pair &b)
+{
+    if (a.selection != b.selection)
+        return a.selection < b.selection;
+    return a.dist2 < b.dist2;
+}
 
-    int pbc = 0;
-    if (use_pbc) pbc = 1;
+static FILE *create_sweep_file(const std::string &out_name)
+{
+    FILE *f = fopen(out_name.c_str(), "w");
+    if (!f) {
+        printf("ERROR: enable to create file %s\n", out_name.c_str());
+        exit(2);
+    }
+    return f;
+}
 
-#pragma omp parallel for schedule(dynamic)
-    for (int m = 0; m < n_particles; m++)
+// Kruskal-style sweep of one selection's pairs (sorted by distance; its
+// particles are first .. first+n_particles-1 of uf and size) over the
+// growing cut-offs; writes <out_name>.txt and <out_name>.hist.
+// count_of_size has room for n_particles+1 entries.
+static void sweep_selection(const selection_pair *pairs, int n_pairs, int first, int n_particles,
+                            const float *cutoffs, int n_cutoffs, const char *out_name,
+                            union_find *uf, int *size, int *count_of_size)
+{
+    for (int i = first; i < first + n_particles; i++)
+        size[i] = 1;
+    // count_of_size[s] = number of clusters of s members
+    for (int sz = 0; sz <= n_particles; sz++)
+        count_of_size[sz] = 0;
+    count_of_size[1] = n_particles;
+    int n_clusters = n_particles, n_multi = 0, max_size = n_particles > 0 ? 1 : 0;
+
+    FILE *summary = create_sweep_file(std::string(out_name) + ".txt");
+    FILE *hist = create_sweep_file(std::string(out_name) + ".hist");
+    fprintf(summary, "# cut n_links n_clusters n_clusters(size>1) min_size max_size average_size\n");
+    fprintf(hist, "# cut size count\n");
+
+    int p = 0;
+    for (int k = 0; k < n_cutoffs; k++)
     {
-        for (int n = m + 1; n < n_particles; n++)
+        float cut2 = cutoffs[k] * cutoffs[k];
+        for (; p < n_pairs && pairs[p].dist2 < cut2; p++)
         {
-            int found = 0;
-            float dx = rx[m] - rx[n];
-            dx -= pbc * Lx * rint(dx / Lx);
-            float dy = ry[m] - ry[n];
-            dy -= pbc * Ly * rint(dy / Ly);
-            float dz = rz[m] - rz[n];
-            dz -= pbc * Lz * rint(dz / Lz);
-            float dist2 = dx * dx + dy * dy + dz * dz;
-
-            if (dist2 < dist_cluster * dist_cluster)
+            int ri = uf_find(uf, pairs[p].i), rj = uf_find(uf, pairs[p].j);
+            if (ri == rj)
+                continue;
+            int si = size[ri], sj = size[rj];
+            uf_union(uf, ri, rj);
+            int root = uf_find(uf, ri);
+            size[root] = si + sj;
+            count_of_size[si]--;
+            count_of_size[sj]--;
+            count_of_size[si + sj]++;
+            n_multi += 1 - (si > 1) - (sj > 1);
+            n_clusters--;
+            if (si + sj > max_size)
+                max_size = si + sj;
+        }
+
+        // Statistics of the clusters of more than one member, as clout_ana2
+        int min_size = 0;
+        for (int sz = 2; sz <= max_size && n_multi > 0; sz++)
+            if (count_of_size[sz] > 0) {
+                min_size = sz;
+                break;
+            }
+        double average = n_multi > 0 ? (double)(n_particles - count_of_size[1]) / n_multi : 0.0;
+        fprintf(summary, "%g %d %d %d %d %d %g\n", cutoffs[k], p, n_clusters, n_multi,
+                min_size, n_multi > 0 ? max_size : 0, average);
+        for (int sz = 1; sz <= max_size; sz++)
+            if (count_of_size[sz] > 0)
+                fprintf(hist, "%g %d %d\n", cutoffs[k], sz, count_of_size[sz]);
+    }
+
+    fclose(summary);
+    fclose(hist);
+}
+
+// Pairs found by the calling thread, kept across calls so that their
+// capacity is reused from frame to frame
+static std::vector<selection_pair> &thread_pairs()
+{
+    static thread_local std::vector<selection_pair> local;
+    local.clear();
+    return local;
+}
+
+void find_selection_pairs(const float *rx, const float *ry, const float *rz,
+                          float dist_cluster, int n_selections, const int *sel_start,
+                          float Lx, float Ly, float Lz,
+                          const char *const *out_names,
+                          bool use_pbc, int dimensions, neighbor_engine engine,
+                          std::vector<selection_pair> *pairs, phase_timings *timings,
+                          frame_arena *arena)
+{
+    apply_pair_schedule();
+
+    int n_particles = sel_start[n_selections];
+    int *selection_of = arena_array<int>(arena, n_particles);
+    for (int g = 0; g < n_selections; g++)
+        for (int i = sel_start[g]; i < sel_start[g + 1]; i++)
+            selection_of[i] = g;
+
+    pair_box box;
+    init_pair_box(&box, Lx, Ly, Lz, dist_cluster);
+
+    if (engine == NEIGHBOR_CELL_LIST)
+    {
+        cell_list cl;
+        build_cell_list(&cl, rx, ry, rz, n_particles, dist_cluster, Lx, Ly, Lz, use_pbc, dimensions,
+                        selection_of, n_selections, arena);
+        pair_kernel kernel = select_pair_kernel(use_pbc, dimensions);
+
+        // Same traversal as neighboring_selections(), keeping the distances
+#pragma omp parallel
+        {
+            double t_thread = wall_time();
+            long long tested = 0;
+            std::vector<selection_pair> &local = thread_pairs();
+#pragma omp for schedule(runtime) nowait
+            for (int run = 0; run < cl.n_runs; run++)
             {
+                int hits[PAIR_BATCH];
+                int range_begin[27], range_end[27];
+                int g = cl.run_key[run];
+                if (!out_names[g])
+                    continue;
+                int n_ranges = neighbour_ranges(&cl, g, cl.run_cell[run], range_begin, range_end);
+                for (int a = cl.run_start[run]; a < cl.run_start[run + 1]; a++)
+                {
+                    for (int c = 0; c < n_ranges; c++)
+                    {
+                        int begin = range_begin[c] <= a ? a + 1 : range_begin[c];
+                        for (; begin < range_end[c]; begin += PAIR_BATCH)
+                        {
+                            int batch_end = begin + PAIR_BATCH < range_end[c] ? begin + PAIR_BATCH : range_end[c];
+                            int n_hits = kernel(cl.xs[a], cl.ys[a], cl.zs[a], cl.xs, cl.ys, cl.zs,
+                                                begin, batch_end, &box, hits);
+                            tested += batch_end - begin;
+                            for (int h = 0; h < n_hits; h++)
+                            {
+                                selection_pair sp;
+                                sp.selection = g;
+                                sp.dist2 = pair_kernel_dist2(cl.xs[a], cl.ys[a], cl.zs[a], cl.xs, cl.ys, cl.zs,
+                                                             hits[h], &box, use_pbc, dimensions);
+                                sp.i = cl.cell_particles[a];
+                                sp.j = cl.cell_particles[hits[h]];
+                                local.push_back(sp);
+                            }
+                        }
+                    }
+                }
+            }
+            add_thread_work(timings, thread_number(), tested, wall_time() - t_thread);
 #pragma omp critical
+            pairs->insert(pairs->end(), local.begin(), local.end());
+        }
+
+        free_cell_list(&cl);
+    }
+    else
+    {
+#pragma omp parallel
+        {
+            double t_thread = wall_time();
+            long long tested = 0;
+            std::vector<selection_pair> &local = thread_pairs();
+#pragma omp for schedule(runtime) nowait
+            for (int m = 0; m < n_particles; m++)
+            {
+                int g = selection_of[m];
+                if (!out_names[g])
+                    continue;
+                tested += sel_start[g + 1] - (m + 1);
+                for (int n = m + 1; n < sel_start[g + 1]; n++)
                 {
-                    if (n_contacts_per_molecule[m] >= max_contacts || n_contacts_per_molecule[n] >= max_contacts)
+                    float dist2 = pair_kernel_dist2(rx[m], ry[m], rz[m], rx, ry, rz, n, &box, use_pbc, dimensions);
+                    if (dist2 < box.cut2)
                     {
-                        fprintf(stderr, "Too many contacts!\n");
-                        exit(EXIT_FAILURE);
+                        selection_pair sp;
+                        sp.selection = g;
+                        sp.dist2 = dist2;
+                        sp.i = m;
+                        sp.j = n;
+                        local.push_back(sp);
                     }
-                    node_next[m][n_contacts_per_molecule[m]++] = n;
-                    node_next[n][n_contacts_per_molecule[n]++] = m;
-                    n_links++;
                 }
-                // found = 1;
-                // break;
             }
+            add_thread_work(timings, thread_number(), tested, wall_time() - t_thread);
+#pragma omp critical
+            pairs->insert(pairs->end(), local.begin(), local.end());
         }
     }
+    arena_release(arena, selection_of);
+}
+
+void sweep_selections(const float *rx, const float *ry, const float *rz,
+                      const float *cutoffs, int n_cutoffs,
+                      int n_selections, const int *sel_start,
+                      float Lx, float Ly, float Lz,
+                      const char *const *out_names,
+                      bool use_pbc, int dimensions, neighbor_engine engine,
+                      phase_timings *timings, frame_arena *arena)
+{
+    double t0 = wall_time();
+
+    // Every pair within the largest cut-off, collected once into a buffer
+    // kept by the calling thread
+    static thread_local std::vector<selection_pair> pairs;
+    pairs.clear();
+    float max_cut = n_cutoffs > 0 ? cutoffs[n_cutoffs - 1] : 0.0f;
+    find_selection_pairs(rx, ry, rz, max_cut, n_selections, sel_start, Lx, Ly, Lz,
+                         out_names, use_pbc, dimensions, engine, &pairs, timings, arena);
+
+    if (timings)
+        timings->seconds[PHASE_PAIRS] += wall_time() - t0;
+
+    t0 = wall_time();
+    std::sort(pairs.begin(), pairs.end(), selection_pair_less);
+
+    // The selections are independent sweeps over their runs of pairs, each
+    // in its own range of one forest
+    int n_particles = sel_start[n_selections];
+    int *pair_start = arena_array<int>(arena, n_selections + 1);
+    for (int g = 0; g <= n_selections; g++)
+        pair_start[g] = 0;
+    for (const auto &sp : pairs)
+        pair_start[sp.selection + 1]++;
+    for (int g = 0; g < n_selections; g++)
+        pair_start[g + 1] += pair_start[g];
+    union_find uf;
+    uf_init(&uf, n_particles, arena);
+    int *size = arena_array<int>(arena, n_particles);
+    int *count_of_size = arena_array<int>(arena, n_particles + n_selections);
+
+#pragma omp parallel for schedule(dynamic)
+    for (int g = 0; g < n_selections; g++)
+    {
+        if (!out_names[g])
+            continue;
+        sweep_selection(pairs.data() + pair_start[g], pair_start[g + 1] - pair_start[g], sel_start[g],
+                        sel_start[g + 1] - sel_start[g], cutoffs, n_cutoffs, out_names[g],
+                        &uf, size, count_of_size + sel_start[g] + g);
+    }
 
-    clustering(node_next, n_contacts_per_molecule, n_links, n_particles, max_contacts, aindex, out_name);
+    uf_free(&uf);
+    arena_release(arena, pair_start);
+    arena_release(arena, size);
+    arena_release(arena, count_of_size);
 
-    for (int i = 0; i < n_particles; i++)
-        free(node_next[i]);
-    free(node_next);
-    free(n_contacts_per_molecule);
+    if (timings)
+        timings->seconds[PHASE_CLUSTERS] += wall_time() - t0;
 }
@@ -0,0 +1,639 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <filesystem>
+#include <sstream>
+#include "frame.h"
+#include "gsd_reader.h"
+#include "molecule.h"
+#include "slab_clustering.h"
+
+// GSD file kept mapped by a reader thread while it reads consecutive
+// frames of the same trajectory
+struct cached_gsd {
+    std::string path;
+    bool open = false;
+    gsd_file g;
+    ~cached_gsd()
+    {
+        if (open)
+            close_gsd(&g);
+    }
+};
+
+static const gsd_file *thread_gsd(const std::string &path)
+{
+    thread_local cached_gsd cache;
+    if (cache.open && cache.path == path)
+        return &cache.g;
+    if (cache.open)
+        close_gsd(&cache.g);
+    cache.path = path;
+    cache.open = open_gsd(path.c_str(), &cache.g);
+    return cache.open ? &cache.g : NULL;
+}
+
+// Topology of the last XML snapshot read by a reader thread, with the
+// type index built from it
+struct cached_topology {
+    topology topo;
+    std::shared_ptr<const type_index> tindex;
+    cached_topology() { init_topology(&topo); }
+    ~cached_topology() { free_topology(&topo); }
+};
+
+std::shared_ptr<const type_index> build_type_index(const run_options &opt, const snapshot *s)
+{
+    int n_types = opt.considered_types.size();
+    int n_type_ids = s->type_names.size();
+    auto ti = std::make_shared<type_index>();
+    ti->considered_types = opt.considered_types;
+    ti->considered_id.assign(n_types, -1);
+    ti->slot_of_type.assign(n_type_ids, -1);
+    for (int i = 0; i < n_types; i++) {
+        auto it = std::find(s->type_names.begin(), s->type_names.end(), opt.considered_types[i]);
+        if (it == s->type_names.end())
+            continue;
+        ti->considered_id[i] = it - s->type_names.begin();
+        if (ti->slot_of_type[ti->considered_id[i]] < 0)
+            ti->slot_of_type[ti->considered_id[i]] = i;
+    }
+
+    if (!opt.all) {
+        for (int ib = 0; ib < s->n_bonds; ib++) {
+            int ai = s->bonds[ib].ai, aj = s->bonds[ib].aj, slot;
+            if ((slot = ti->slot_of_type[s->bonds[ib].typei]) >= 0) {
+                ti->bond_head.push_back(ai);
+                ti->bond_tail.push_back(aj);
+            } else if ((slot = ti->slot_of_type[s->bonds[ib].typej]) >= 0) {
+                ti->bond_head.push_back(aj);
+                ti->bond_tail.push_back(ai);
+            } else {
+                continue;
+            }
+            ti->bond_slot.push_back(slot);
+        }
+    }
+
+    if (opt.molecules) {
+        // Only the particles of a considered type take part in the contact
+        // search (all particles when no types are given)
+        molecule_index mi;
+        build_molecules(&mi, s->n_particles, s->bonds, s->n_bonds);
+        std::vector<char> considered(n_type_ids, n_types == 0);
+        for (int i = 0; i < n_types; i++)
+            if (ti->considered_id[i] >= 0)
+                considered[ti->considered_id[i]] = 1;
+        ti->n_molecules = mi.n_molecules;
+        ti->mol_start.push_back(0);
+        for (int m = 0; m < mi.n_molecules; m++) {
+            for (int k = mi.mol_start[m]; k < mi.mol_start[m + 1]; k++)
+                if (considered[s->types[mi.mol_particles[k]]])
+                    ti->mol_particles.push_back(mi.mol_particles[k]);
+            if ((int)ti->mol_particles.size() > ti->mol_start.back()) {
+                ti->mol_start.push_back(ti->mol_particles.size());
+                ti->mol_id.push_back(m);
+            }
+        }
+        free_molecules(&mi);
+    }
+    return ti;
+}
+
+void init_snapshot(snapshot *s)
+{
+    s->x = s->y = s->z = NULL;
+    s->vx = s->vy = s->vz = NULL;
+    s->ix = s->iy = s->iz = NULL;
+    s->types = NULL;
+    s->bonds = NULL;
+    s->capacity = s->bond_capacity = 0;
+    s->n_particles = s->n_bonds = 0;
+}
+
+void read_snapshot(const run_options &opt, size_t index, const snapshot_source &src,
+                   snapshot *s)
+{
+    const std::string &file = src.file;
+    s->index = index;
+    s->file = file;
+    s->frame = src.frame;
+    s->name = std::filesystem::path(file).replace_extension().filename().string();
+    if (src.frame >= 0)
+        s->name += "_frame" + std::to_string(src.frame);
+    s->n_particles = s->n_bonds = 0;
+    s->lx = s->ly = s->lz = s->xy = s->xz = s->yz = 0;
+    s->tindex = NULL;
+    s->topology_reused = false;
+    reset_timings(&s->timings);
+
+    if (!std::filesystem::exists(std::filesystem::path(file))) {
+        s->status = 1;
+        return;
+    }
+
+    thread_local cached_topology cache;
+    double t0 = wall_time();
+    if (src.frame >= 0) {
+        const gsd_file *g = thread_gsd(file);
+        if (opt.n_slabs > 0) {
+            // Streamed slab by slab when processed, never read whole
+            s->status = g && src.frame < g->n_frames ? 0 : 2;
+            return;
+        }
+        if (!g || read_gsd_frame(g, src.frame,
+                                 &s->x, &s->y, &s->z,
+                                 &s->vx, &s->vy, &s->vz,
+                                 &s->ix, &s->iy, &s->iz,
+                                 &s->types, &s->type_names,
+                                 &s->n_particles,
+                                 &s->bonds, &s->n_bonds,
+                                 &s->lx, &s->ly, &s->lz, &s->xy, &s->xz, &s->yz,
+                                 &s->dimensions, &s->capacity, &s->bond_capacity) != 0) {
+            s->status = 2;
+            return;
+        }
+        s->timings.counts[COUNT_BYTES_PARSED] = gsd_frame_bytes(g, src.frame);
+    } else if (parse_hoomd_xml(file.c_str(),
+                        &s->x, &s->y, &s->z,
+                        &s->vx, &s->vy, &s->vz,
+                        &s->ix, &s->iy, &s->iz,
+                        &s->types, &s->type_names,
+                        &s->n_particles,
+                        &s->bonds, &s->n_bonds,
+                        &s->lx, &s->ly, &s->lz, &s->xy, &s->xz, &s->yz,
+                        &s->dimensions, &cache.topo, opt.verlet_skin > 0,
+                        &s->capacity, &s->bond_capacity) != 0) {
+        s->status = 2;
+        return;
+    } else {
+        s->timings.counts[COUNT_BYTES_PARSED] = std::filesystem::file_size(std::filesystem::path(file));
+    }
+    s->status = 0;
+    s->timings.seconds[PHASE_PARSE] = wall_time() - t0;
+
+    if (src.frame < 0) {
+        // The type index of an unchanged topology is shared, not rebuilt
+        t0 = wall_time();
+        s->topology_reused = cache.topo.reused;
+        if (!cache.topo.reused || !cache.tindex ||
+            cache.tindex->considered_types != opt.considered_types)
+            cache.tindex = build_type_index(opt, s);
+        s->tindex = cache.tindex;
+        s->timings.seconds[PHASE_PARTITION] = wall_time() - t0;
+    }
+}
+
+// --stats-only rows of one selection: the summary row (the columns of the
+// clout_ana2 .summary files), its histogram rows and its largest cluster.
+// Nothing if the selection was not clustered.
+static void stats_rows(const std::vector<cluster_stats> &stats, const std::string &name,
+                       size_t index, std::string *summary, std::string *hist,
+                       std::string *largest)
+{
+    summary->clear();
+    hist->clear();
+    largest->clear();
+    const cluster_stats *st = NULL;
+    for (const auto &candidate : stats)
+        if (candidate.name == name)
+            st = &candidate;
+    if (!st)
+        return;
+
+    std::ostringstream rows;
+    rows << index << " " << st->n_clusters << " " << st->min_size << " " << st->max_size
+         << " " << st->mean_size << " " << name << "\n";
+    *summary = rows.str();
+    rows.str("");
+    for (size_t size = 0; size < st->histogram.size(); size++)
+        if (st->histogram[size] > 0)
+            rows << index << " " << size << " " << st->histogram[size] << "\n";
+    *hist = rows.str();
+    rows.str("");
+    rows << index << " " << st->max_size;
+    for (int id : st->largest)
+        rows << " " << id;
+    rows << "\n";
+    *largest = rows.str();
+}
+
+// One line of the --metrics file
+static std::string metrics_line(const snapshot *s, const std::string &source,
+                                const frame_result *r, const frame_arena *arena)
+{
+    std::string escaped;
+    for (char c : source) {
+        if (c == '"' || c == '\\')
+            escaped += '\\';
+        escaped += c;
+    }
+    char buf[160];
+    snprintf(buf, sizeof(buf), "{\"index\": %zu, \"source\": \"", s->index);
+    std::string line = buf + escaped;
+    snprintf(buf, sizeof(buf), "\", \"status\": %d, \"particles\": %d, ", s->status, s->n_particles);
+    line += buf + format_metrics_json(&r->timings);
+    snprintf(buf, sizeof(buf), ", \"arena_bytes\": %zu, \"arena_spills\": %d, \"peak_rss_kb\": %ld}\n",
+             arena ? arena->frame_bytes : 0, arena ? arena->n_spills : 0, peak_rss_kb());
+    return line + buf;
+}
+
+// Timings and memory of a clustered snapshot, at the end of its log
+static void finish_frame(const run_options &opt, const snapshot *s, const std::string &source,
+                         frame_result *r, std::ostringstream &log, const frame_arena *arena)
+{
+    log << format_timings("Timings:", &r->timings);
+    char memory[128];
+    if (arena)
+        snprintf(memory, sizeof(memory), "Memory: arena %.1f MB, %d arena spills, peak RSS %.1f MB\n",
+                 arena->frame_bytes / 1048576.0, arena->n_spills, peak_rss_kb() / 1024.0);
+    else
+        snprintf(memory, sizeof(memory), "Memory: peak RSS %.1f MB\n", peak_rss_kb() / 1024.0);
+    log << memory;
+    r->log = log.str();
+    if (opt.metrics)
+        r->metrics_line = metrics_line(s, source, r, arena);
+}
+
+// --slabs: the whole types of a GSD frame streamed from the file and
+// clustered slab by slab (see slab_clustering.h). Returns false if the
+// frame cannot be read.
+static bool process_slabs(const run_options &opt, snapshot *s, const std::string &source,
+                          frame_result *r, std::ostringstream &log, frame_arena *arena)
+{
+    int n_types = opt.considered_types.size();
+    std::string ext = opt.format == CLUSTER_TEXT ? ".txt" : ".bin";
+    bool stats_only = opt.format == CLUSTER_STATS_ONLY;
+    if (stats_only)
+        ext.clear();
+
+    // A type given twice is clustered once, into the file of its first slot
+    std::vector<std::string> type_files(n_types);
+    std::vector<const char *> names(n_types, NULL);
+    std::vector<int> slot(n_types);
+    for (int i = 0; i < n_types; i++) {
+        const std::string &ptype = opt.considered_types[i];
+        slot[i] = std::find(opt.considered_types.begin(), opt.considered_types.end(), ptype) - opt.considered_types.begin();
+        type_files[i] = s->name + "_type_" + ptype + "_neighboring" + ext;
+        r->all_lines[i] = type_files[i] + '\t' + source + '\t' + ptype + "all" + '\t' + '\n';
+    }
+    for (int i = 0; i < n_types; i++)
+        if (slot[i] == i)
+            names[i] = type_files[i].c_str();
+
+    slab_options sopt;
+    sopt.cutoff = opt.cluster_cutoff;
+    sopt.n_slabs = opt.n_slabs;
+    sopt.use_pbc = opt.use_pbc;
+    sopt.engine = opt.engine;
+    sopt.format = opt.format;
+    std::vector<cluster_stats> stats;
+    slab_report report;
+    const gsd_file *g = thread_gsd(s->file);
+    if (!g || cluster_gsd_slabs(g, s->frame, sopt, opt.considered_types, names.data(),
+                                s->name + "_slab_boundary.tmp", &stats, &report, &r->timings, arena) != 0) {
+        for (int i = 0; i < n_types; i++)
+            r->all_lines[i].clear();
+        return false;
+    }
+    s->n_particles = report.n_particles;
+
+    log << "Slabs: " << report.n_slabs << " along " << "xyz"[report.axis]
+        << ", at most " << report.max_slab << " particles in memory, "
+        << report.n_boundary << " clusters at slab faces\n";
+    for (int i = 0; i < n_types; i++) {
+        log << "Type " << opt.considered_types[i] << " all: " << report.n_selected[slot[i]] << "\n";
+        if (stats_only)
+            stats_rows(stats, type_files[i], s->index, &r->all_lines[i], &r->all_hist[i], &r->all_largest[i]);
+    }
+    return true;
+}
+
+void process_snapshot(const run_options &opt, snapshot *s, frame_result *r,
+                      verlet_list *verlet, frame_arena *arena)
+{
+    int n_types = opt.considered_types.size();
+    std::ostringstream log;
+    if (arena)
+        arena_reset(arena);
+
+    r->index = s->index;
+    r->timings = s->timings;
+    r->verlet_used = r->verlet_rebuilt = false;
+    r->all_lines.assign(n_types, std::string());
+    r->up_lines.assign(n_types, std::string());
+    r->down_lines.assign(n_types, std::string());
+    r->all_hist.assign(n_types, std::string());
+    r->up_hist.assign(n_types, std::string());
+    r->down_hist.assign(n_types, std::string());
+    r->all_largest.assign(n_types, std::string());
+    r->up_largest.assign(n_types, std::string());
+    r->down_largest.assign(n_types, std::string());
+    r->molecules_line.clear();
+    r->molecules_hist.clear();
+    r->molecules_largest.clear();
+
+    // Source as written to the logs and clusterfiles_* indices
+    std::string source = s->file;
+    if (s->frame >= 0)
+        source += ":" + std::to_string(s->frame);
+
+    r->metrics_line.clear();
+    if (s->status == 1) {
+        r->errors = "File not found: " + s->file + "! skipping...\n";
+        if (opt.metrics)
+            r->metrics_line = metrics_line(s, source, r, arena);
+        return;
+    }
+
+    log << "System: " << source << "\n";
+    log << "Cut-off: " << opt.cluster_cutoff << "\n";
+    log << "Types: ";
+    for (const auto &t : opt.considered_types)
+        log << t << " ";
+    log << "\n";
+
+    if (s->status != 0) {
+        r->errors = "Error during parsing: " + source + "! skipping...\n";
+        r->log = log.str();
+        if (opt.metrics)
+            r->metrics_line = metrics_line(s, source, r, arena);
+        return;
+    }
+
+    if (opt.n_slabs > 0 && s->frame >= 0) {
+        if (!process_slabs(opt, s, source, r, log, arena)) {
+            r->errors = "Error during parsing: " + source + "! skipping...\n";
+            r->log = log.str();
+            if (opt.metrics)
+                r->metrics_line = metrics_line(s, source, r, arena);
+            return;
+        }
+        finish_frame(opt, s, source, r, log, arena);
+        return;
+    }
+
+    double t0 = wall_time();
+
+    // Type id of every considered type (-1 if the file has no such type)
+    // and, per type id, the first slot in opt.considered_types naming it
+    std::shared_ptr<const type_index> tindex = s->tindex ? s->tindex : build_type_index(opt, s);
+    const std::vector<int> &considered_id = tindex->considered_id;
+    const std::vector<int> &slot_of_type = tindex->slot_of_type;
+
+    if (opt.calc_com) {
+        float x_com = 0, y_com = 0, z_com = 0;
+        for (int i = 0; i < s->n_particles; i++) {
+            x_com += s->x[i];
+            y_com += s->y[i];
+            z_com += s->z[i];
+        }
+
+        x_com /= s->n_particles;
+        y_com /= s->n_particles;
+        z_com /= s->n_particles;
+
+        for (int i = 0; i < s->n_particles; i++) {
+            s->x[i] -= x_com;
+            s->y[i] -= y_com;
+            s->z[i] -= z_com;
+        }
+    }
+
+    // Counting sort of the particles of considered types by slot: the type
+    // of slot i occupies [type_start[i], type_start[i+1]) of the
+    // x_type/.../andx_type arrays (empty for repeated or absent types)
+    int *type_start = arena_array<int>(arena, n_types + 1);
+    memset(type_start, 0, sizeof(int) * (n_types + 1));
+    float *x_type = NULL, *y_type = NULL, *z_type = NULL;
+    int *andx_type = NULL;
+    if (opt.all) {
+        for (int i = 0; i < s->n_particles; i++)
+            if (slot_of_type[s->types[i]] >= 0)
+                type_start[slot_of_type[s->types[i]] + 1]++;
+        for (int i = 0; i < n_types; i++)
+            type_start[i + 1] += type_start[i];
+        int n_selected = type_start[n_types];
+        x_type = arena_array<float>(arena, n_selected);
+        y_type = arena_array<float>(arena, n_selected);
+        z_type = arena_array<float>(arena, n_selected);
+        andx_type = arena_array<int>(arena, n_selected);
+        int *fill = arena_array<int>(arena, n_types);
+        memcpy(fill, type_start, sizeof(int) * n_types);
+        for (int i = 0; i < s->n_particles; i++) {
+            int slot = slot_of_type[s->types[i]];
+            if (slot < 0)
+                continue;
+            int k = fill[slot]++;
+            x_type[k] = s->x[i]; y_type[k] = s->y[i]; z_type[k] = s->z[i];
+            andx_type[k] = i;
+        }
+        arena_release(arena, fill);
+    }
+
+    // Heads of the bonds to a considered type, split into up and down
+    // layers; counting-sorted by (slot, layer) into layer_start ranges
+    // with key 2*slot for the upper and 2*slot+1 for the lower layer
+    int *layer_start = arena_array<int>(arena, 2 * n_types + 1);
+    memset(layer_start, 0, sizeof(int) * (2 * n_types + 1));
+    float *x_layer = NULL, *y_layer = NULL, *z_layer = NULL;
+    int *andx_layer = NULL;
+    if (!opt.all) {
+        int n_pairs = tindex->bond_head.size();
+        int *bond_key = arena_array<int>(arena, n_pairs);
+        for (int ib=0; ib < n_pairs; ib++)
+            bond_key[ib] = -1;
+        for (int ib=0; ib < n_pairs; ib++) {
+            int hndx = tindex->bond_head[ib], tndx = tindex->bond_tail[ib], slot = tindex->bond_slot[ib];
+            float xhead = s->x[hndx], yhead = s->y[hndx], zhead = s->z[hndx];
+            float dx = xhead - s->x[tndx], dy = yhead - s->y[tndx], dz = zhead - s->z[tndx];
+            float dx_dot_rhead = dx * xhead + dy * yhead + dz * zhead;
+            if (dx_dot_rhead > 0 && opt.up_layer) {
+                bond_key[ib] = 2 * slot;
+            } else if ( opt.down_layer ) {
+                bond_key[ib] = 2 * slot + 1;
+            } else {
+                continue;
+            }
+            layer_start[bond_key[ib] + 1]++;
+        }
+        for (int k = 0; k < 2 * n_types; k++)
+            layer_start[k + 1] += layer_start[k];
+        int n_heads = layer_start[2 * n_types];
+        x_layer = arena_array<float>(arena, n_heads);
+        y_layer = arena_array<float>(arena, n_heads);
+        z_layer = arena_array<float>(arena, n_heads);
+        andx_layer = arena_array<int>(arena, n_heads);
+        int *fill = arena_array<int>(arena, 2 * n_types);
+        memcpy(fill, layer_start, sizeof(int) * 2 * n_types);
+        for (int ib=0; ib < n_pairs; ib++) {
+            if (bond_key[ib] < 0)
+                continue;
+            int k = fill[bond_key[ib]]++, h = tindex->bond_head[ib];
+            x_layer[k] = s->x[h]; y_layer[k] = s->y[h]; z_layer[k] = s->z[h];
+            andx_layer[k] = h;
+        }
+        arena_release(arena, fill);
+        arena_release(arena, bond_key);
+    }
+    r->timings.seconds[PHASE_PARTITION] += wall_time() - t0;
+
+    log << "Parsed " << s->n_particles << " particles.\n";
+    log << "Parsed " << s->n_bonds << " bonds.\n";
+    if (s->topology_reused)
+        log << "Topology: cached\n";
+
+    std::string ext = opt.format == CLUSTER_TEXT ? ".txt" : ".bin";
+    if (opt.format == CLUSTER_STATS_ONLY)
+        ext.clear();
+
+    // Every (type, layer) selection is a range of x_type or x_layer; all of
+    // them are clustered against one spatial index per frame
+    std::vector<std::string> type_files(n_types), layer_files(2 * n_types);
+    for (int i = 0; i < n_types; i++) {
+        std::string ptype = opt.considered_types[i];
+        int t = considered_id[i];
+        int slot = t < 0 ? i : slot_of_type[t];
+        int all_count = type_start[slot + 1] - type_start[slot];
+        int up_count = layer_start[2 * slot + 1] - layer_start[2 * slot];
+        int down_count = layer_start[2 * slot + 2] - layer_start[2 * slot + 1];
+
+        log << "Type " << ptype ;
+        if ( opt.all )
+        log << " all: "<< all_count;
+        if ( opt.up_layer )
+        log << " upper layer: "<< up_count;
+        if ( opt.down_layer )
+        log << "  down layer: "<< down_count;
+        log << "\n";
+        
+        std::string filename;
+        if (opt.all) {
+            filename = s->name + "_type_" + ptype + "_neighboring" + ext;
+            type_files[slot] = filename;
+            r->all_lines[i] = filename + '\t' + source + '\t' + ptype + "all" + '\t' + '\n';
+        }
+        
+        if ( opt.up_layer ) {
+            filename = s->name + "_up_type_" + ptype + "_neighboring" + ext;
+            layer_files[2 * slot] = filename;
+            r->up_lines[i] = filename + '\t' + source + '\t' + ptype + '\t' + "up" + '\n';
+        }
+        
+        if ( opt.down_layer ) {
+            filename = s->name + "_down_type_" + ptype + "_neighboring" + ext;
+            layer_files[2 * slot + 1] = filename;
+            r->down_lines[i] = filename + '\t' + source + '\t' + ptype + '\t' + "down" + '\n';
+        }
+    }
+
+    if (!opt.sweep_cutoffs.empty()) {
+        // Cut-off sweep: statistics files instead of cluster files, which
+        // are therefore not listed in the clusterfiles_* indices
+        for (int i = 0; i < n_types; i++) {
+            int t = considered_id[i];
+            int slot = t < 0 ? i : slot_of_type[t];
+            std::string ptype = opt.considered_types[i];
+            if (opt.all)
+                type_files[slot] = s->name + "_type_" + ptype + "_cutsweep";
+            if (opt.up_layer)
+                layer_files[2 * slot] = s->name + "_up_type_" + ptype + "_cutsweep";
+            if (opt.down_layer)
+                layer_files[2 * slot + 1] = s->name + "_down_type_" + ptype + "_cutsweep";
+            r->all_lines[i].clear();
+            r->up_lines[i].clear();
+            r->down_lines[i].clear();
+        }
+    }
+
+    // --stats-only: the statistics of every clustered selection instead of
+    // its cluster file
+    std::vector<cluster_stats> stats;
+    bool stats_only = opt.format == CLUSTER_STATS_ONLY && opt.sweep_cutoffs.empty();
+    set_cluster_stats_sink(stats_only ? &stats : NULL);
+
+    std::vector<const char *> names;
+    for (const auto &f : opt.all ? type_files : layer_files)
+        names.push_back(f.empty() ? NULL : f.c_str());
+    if (!opt.sweep_cutoffs.empty()) {
+        log << "Cut-off sweep: " << opt.sweep_cutoffs.size() << " cut-offs from " << opt.sweep_cutoffs.front() << " to " << opt.sweep_cutoffs.back() << "\n";
+        if (opt.all)
+            sweep_selections(x_type, y_type, z_type, opt.sweep_cutoffs.data(), opt.sweep_cutoffs.size(), n_types, type_start, s->lx, s->ly, s->lz, names.data(), opt.use_pbc, s->dimensions, opt.engine, &r->timings, arena);
+        else
+            sweep_selections(x_layer, y_layer, z_layer, opt.sweep_cutoffs.data(), opt.sweep_cutoffs.size(), 2 * n_types, layer_start, s->lx, s->ly, s->lz, names.data(), opt.use_pbc, s->dimensions, opt.engine, &r->timings, arena);
+    } else if (opt.all && verlet) {
+        r->verlet_used = true;
+        r->verlet_rebuilt = verlet_selections(verlet, x_type, y_type, z_type, s->ix, s->iy, s->iz, opt.cluster_cutoff, n_types, type_start, s->lx, s->ly, s->lz, andx_type, names.data(), opt.use_pbc, s->dimensions, opt.engine, &r->timings, arena);
+        log << "Verlet list: " << (r->verlet_rebuilt ? "rebuilt" : "reused") << "\n";
+    } else if (opt.all)
+        neighboring_selections(x_type, y_type, z_type, opt.cluster_cutoff, n_types, type_start, s->lx, s->ly, s->lz, andx_type, names.data(), opt.use_pbc, s->dimensions, opt.engine, &r->timings, arena);
+    else
+        neighboring_selections(x_layer, y_layer, z_layer, opt.cluster_cutoff, 2 * n_types, layer_start, s->lx, s->ly, s->lz, andx_layer, names.data(), opt.use_pbc, s->dimensions, opt.engine, &r->timings, arena);
+
+    if (stats_only) {
+        for (int i = 0; i < n_types; i++) {
+            int t = considered_id[i];
+            int slot = t < 0 ? i : slot_of_type[t];
+            if (opt.all)
+                stats_rows(stats, type_files[slot], s->index, &r->all_lines[i], &r->all_hist[i], &r->all_largest[i]);
+            if (opt.up_layer)
+                stats_rows(stats, layer_files[2 * slot], s->index, &r->up_lines[i], &r->up_hist[i], &r->up_largest[i]);
+            if (opt.down_layer)
+                stats_rows(stats, layer_files[2 * slot + 1], s->index, &r->down_lines[i], &r->down_hist[i], &r->down_largest[i]);
+        }
+    }
+
+    arena_release(arena, type_start);
+    arena_release(arena, x_type); arena_release(arena, y_type); arena_release(arena, z_type);
+    arena_release(arena, andx_type);
+    arena_release(arena, layer_start);
+    arena_release(arena, x_layer); arena_release(arena, y_layer); arena_release(arena, z_layer);
+    arena_release(arena, andx_layer);
+
+    if (opt.molecules) {
+        // Molecules from the bond graph, indexed with the topology. Positions
+        // are gathered molecule by molecule so every molecule is a
+        // contiguous range.
+        t0 = wall_time();
+        int n_molecules = tindex->mol_id.size();
+        int n_mol_particles = tindex->mol_particles.size();
+        float *x_mol = arena_array<float>(arena, n_mol_particles);
+        float *y_mol = arena_array<float>(arena, n_mol_particles);
+        float *z_mol = arena_array<float>(arena, n_mol_particles);
+        int *mol_id = arena_array<int>(arena, n_molecules);
+        for (int k = 0; k < n_mol_particles; k++) {
+            int p = tindex->mol_particles[k];
+            x_mol[k] = s->x[p]; y_mol[k] = s->y[p]; z_mol[k] = s->z[p];
+        }
+        std::copy(tindex->mol_id.begin(), tindex->mol_id.end(), mol_id);
+        r->timings.seconds[PHASE_PARTITION] += wall_time() - t0;
+
+        log << "Molecules: " << tindex->n_molecules << " considered: " << n_molecules << "\n";
+
+        std::string filename = s->name + "_molecules_neighboring" + ext;
+        neighboring(x_mol, y_mol, z_mol, opt.cluster_cutoff, n_molecules, tindex->mol_start.data(), s->lx, s->ly, s->lz, mol_id, filename.c_str(), opt.use_pbc, s->dimensions, opt.engine, &r->timings, arena);
+        arena_release(arena, x_mol); arena_release(arena, y_mol); arena_release(arena, z_mol);
+        arena_release(arena, mol_id);
+        r->molecules_line = filename + '\t' + source + '\t' + "molecules" + '\t' + '\n';
+        if (stats_only)
+            stats_rows(stats, filename, s->index, &r->molecules_line, &r->molecules_hist, &r->molecules_largest);
+    }
+    set_cluster_stats_sink(NULL);
+    finish_frame(opt, s, source, r, log, arena);
+}
+
+void free_snapshot(snapshot *s)
+{
+    free(s->x); free(s->y); free(s->z);
+    free(s->vx); free(s->vy); free(s->vz);
+    free(s->ix); free(s->iy); free(s->iz);
+    free(s->types);
+    free(s->bonds);
+    s->x = s->y = s->z = NULL;
+    s->vx = s->vy = s->vz = NULL;
+    s->ix = s->iy = s->iz = NULL;
+    s->types = NULL;
+    s->bonds = NULL;
+    s->capacity = s->bond_capacity = 0;
+}
@@ -0,0 +1,481 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include "gsd_reader.h"
+
+static size_t type_size(uint8_t type)
+{
+    switch (type)
+    {
+    case GSD_TYPE_UINT8: case GSD_TYPE_INT8: case GSD_TYPE_CHARACTER: return 1;
+    case GSD_TYPE_UINT16: case GSD_TYPE_INT16: return 2;
+    case GSD_TYPE_UINT32: case GSD_TYPE_INT32: case GSD_TYPE_FLOAT: return 4;
+    case GSD_TYPE_UINT64: case GSD_TYPE_INT64: case GSD_TYPE_DOUBLE: return 8;
+    default: return 0;
+    }
+}
+
+static bool entry_less(const gsd_index_entry *a, const gsd_index_entry *b)
+{
+    if (a->frame != b->frame)
+        return a->frame < b->frame;
+    return a->id < b->id;
+}
+
+bool open_gsd(const char *path, gsd_file *g)
+{
+    g->data = NULL;
+    g->size = 0;
+    g->names.clear();
+    g->index.clear();
+    g->frame_start.clear();
+    g->n_frames = 0;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(gsd_file_header))
+    {
+        close(fd);
+        return false;
+    }
+    g->size = st.st_size;
+    void *p = mmap(NULL, g->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        return false;
+    g->data = (const char *)p;
+
+    memcpy(&g->header, g->data, sizeof(g->header));
+    const gsd_file_header &h = g->header;
+    size_t index_bytes = h.index_allocated_entries * sizeof(gsd_index_entry);
+    // The name list is counted in 64-byte entries before 2.0 and in bytes since
+    size_t namelist_bytes = (h.gsd_version >> 16) < 2 ? h.namelist_allocated_entries * 64
+                                                      : h.namelist_allocated_entries;
+    if (h.magic != GSD_MAGIC || (h.gsd_version >> 16) < 1 || (h.gsd_version >> 16) > 2 ||
+        h.index_location > g->size || index_bytes > g->size - h.index_location ||
+        h.namelist_location > g->size || namelist_bytes > g->size - h.namelist_location)
+    {
+        close_gsd(g);
+        return false;
+    }
+
+    // Names: fixed 64-byte slots before 2.0, packed NUL-terminated strings since
+    const char *names = g->data + h.namelist_location;
+    if ((h.gsd_version >> 16) < 2)
+    {
+        for (size_t i = 0; i < h.namelist_allocated_entries; i++)
+            g->names.emplace_back(names + 64 * i, strnlen(names + 64 * i, 64));
+    }
+    else
+    {
+        for (size_t pos = 0; pos < namelist_bytes && names[pos] != '\0';)
+        {
+            size_t len = strnlen(names + pos, namelist_bytes - pos);
+            g->names.emplace_back(names + pos, len);
+            pos += len + 1;
+        }
+    }
+
+    // Valid entries, grouped by frame
+    const gsd_index_entry *entries = (const gsd_index_entry *)(g->data + h.index_location);
+    for (size_t i = 0; i < h.index_allocated_entries; i++)
+    {
+        const gsd_index_entry *e = &entries[i];
+        if (e->location == 0)
+            continue;
+        size_t bytes = e->N * e->M * type_size(e->type);
+        if (type_size(e->type) == 0 || (uint64_t)e->location + bytes > g->size ||
+            e->id >= g->names.size())
+        {
+            close_gsd(g);
+            return false;
+        }
+        g->index.push_back(e);
+    }
+    std::stable_sort(g->index.begin(), g->index.end(), entry_less);
+    g->n_frames = g->index.empty() ? 0 : (long long)g->index.back()->frame + 1;
+    g->frame_start.assign(g->n_frames + 1, 0);
+    for (const gsd_index_entry *e : g->index)
+        g->frame_start[e->frame + 1]++;
+    for (long long f = 0; f < g->n_frames; f++)
+        g->frame_start[f + 1] += g->frame_start[f];
+    return true;
+}
+
+void close_gsd(gsd_file *g)
+{
+    if (g->data)
+        munmap((void *)g->data, g->size);
+    g->data = NULL;
+    g->size = 0;
+    g->index.clear();
+}
+
+size_t gsd_frame_bytes(const gsd_file *g, long long frame)
+{
+    size_t bytes = 0;
+    if (frame < 0 || frame >= g->n_frames)
+        return 0;
+    for (size_t k = g->frame_start[frame]; k < g->frame_start[frame + 1]; k++)
+        bytes += g->index[k]->N * g->index[k]->M * type_size(g->index[k]->type);
+    return bytes;
+}
+
+// Chunk `name` of `frame`, or of frame 0 when the frame does not have it
+static const gsd_index_entry *find_chunk(const gsd_file *g, long long frame, const char *name)
+{
+    for (long long f : {frame, 0LL})
+    {
+        if (f >= g->n_frames)
+            continue;
+        for (size_t k = g->frame_start[f]; k < g->frame_start[f + 1]; k++)
+            if (g->names[g->index[k]->id] == name)
+                return g->index[k];
+    }
+    return NULL;
+}
+
+// Element (row, col) of a chunk as a double / integer
+static double chunk_real(const gsd_file *g, const gsd_index_entry *e, uint64_t row, uint32_t col)
+{
+    const char *p = g->data + e->location + (row * e->M + col) * type_size(e->type);
+    switch (e->type)
+    {
+    case GSD_TYPE_FLOAT: { float v; memcpy(&v, p, 4); return v; }
+    case GSD_TYPE_DOUBLE: { double v; memcpy(&v, p, 8); return v; }
+    default: break;
+    }
+    return 0;
+}
+
+static long long chunk_int(const gsd_file *g, const gsd_index_entry *e, uint64_t row, uint32_t col)
+{
+    const char *p = g->data + e->location + (row * e->M + col) * type_size(e->type);
+    switch (e->type)
+    {
+    case GSD_TYPE_UINT8: case GSD_TYPE_CHARACTER: return *(const uint8_t *)p;
+    case GSD_TYPE_INT8: return *(const int8_t *)p;
+    case GSD_TYPE_UINT16: { uint16_t v; memcpy(&v, p, 2); return v; }
+    case GSD_TYPE_INT16: { int16_t v; memcpy(&v, p, 2); return v; }
+    case GSD_TYPE_UINT32: { uint32_t v; memcpy(&v, p, 4); return v; }
+    case GSD_TYPE_INT32: { int32_t v; memcpy(&v, p, 4); return v; }
+    case GSD_TYPE_UINT64: { uint64_t v; memcpy(&v, p, 8); return (long long)v; }
+    case GSD_TYPE_INT64: { int64_t v; memcpy(&v, p, 8); return v; }
+    default: break;
+    }
+    return 0;
+}
+
+// Names stored as rows of NUL-padded characters (particles/types, bonds/types)
+static std::vector<std::string> chunk_strings(const gsd_file *g, const gsd_index_entry *e)
+{
+    std::vector<std::string> out;
+    if (!e || type_size(e->type) != 1)
+        return out;
+    for (uint64_t r = 0; r < e->N; r++)
+    {
+        const char *row = g->data + e->location + r * e->M;
+        out.emplace_back(row, strnlen(row, e->M));
+    }
+    return out;
+}
+
+// Makes *p an array of at least n elements; with capacity, an array of
+// *capacity elements passed in is reused when large enough
+template <typename T>
+static void reserve_array(T **p, int n, const int *capacity)
+{
+    if (capacity && n <= *capacity)
+        return;
+    if (capacity)
+        free(*p);
+    *p = (T *)malloc(sizeof(T) * (n > 0 ? n : 1));
+}
+
+// Per-particle column `col` of an N x M float chunk into out
+// (zeros where the chunk is missing or short)
+static void read_column(const gsd_file *g, const gsd_index_entry *e, int n, uint32_t col, float *out)
+{
+    int rows = !e || col >= e->M ? 0 : e->N < (uint64_t)n ? (int)e->N : n;
+    memset(out + rows, 0, sizeof(float) * (n - rows));
+    if (rows == 0)
+        return;
+    if (e->type == GSD_TYPE_FLOAT)
+    {
+        // Straight from the mapping: a strided copy, no conversion
+        const float *src = (const float *)(g->data + e->location);
+        for (int i = 0; i < rows; i++)
+            out[i] = src[(size_t)i * e->M + col];
+    }
+    else
+    {
+        for (int i = 0; i < rows; i++)
+            out[i] = (float)chunk_real(g, e, i, col);
+    }
+}
+
+static void read_int_column(const gsd_file *g, const gsd_index_entry *e, int n, uint32_t col, int *out)
+{
+    int rows = !e || col >= e->M ? 0 : e->N < (uint64_t)n ? (int)e->N : n;
+    memset(out + rows, 0, sizeof(int) * (n - rows));
+    for (int i = 0; i < rows; i++)
+        out[i] = (int)chunk_int(g, e, i, col);
+}
+
+static uint16_t intern_name(std::vector<std::string> *names, const std::string &name)
+{
+    auto it = std::find(names->begin(), names->end(), name);
+    if (it != names->end())
+        return (uint16_t)(it - names->begin());
+    names->push_back(name);
+    return (uint16_t)(names->size() - 1);
+}
+
+// Particle type names (schema default: a single type "A") into
+// type_names, and the type id of every row of particles/types
+static std::vector<uint16_t> particle_type_ids(const gsd_file *g, long long frame,
+                                               std::vector<std::string> *type_names)
+{
+    type_names->clear();
+    std::vector<std::string> particle_types = chunk_strings(g, find_chunk(g, frame, "particles/types"));
+    if (particle_types.empty())
+        particle_types.push_back("A");
+    std::vector<uint16_t> type_of_row;
+    for (const auto &t : particle_types)
+        type_of_row.push_back(intern_name(type_names, t));
+    return type_of_row;
+}
+
+// Number of particles of a frame: particles/N, or the rows of the
+// positions when it is missing or does not fit them
+static long long frame_particles(const gsd_file *g, long long frame, const gsd_index_entry *position)
+{
+    const gsd_index_entry *e = find_chunk(g, frame, "particles/N");
+    long long n = e ? chunk_int(g, e, 0, 0) : (long long)position->N;
+    if (n < 0 || (uint64_t)n > position->N)
+        n = position->N;
+    return n;
+}
+
+// Box lengths and dimensions of a frame (configuration/box, /dimensions)
+static void frame_box(const gsd_file *g, long long frame, float *box, int *dimensions)
+{
+    const gsd_index_entry *e = find_chunk(g, frame, "configuration/dimensions");
+    *dimensions = e && chunk_int(g, e, 0, 0) == 2 ? 2 : 3;
+
+    const float defaults[6] = {1, 1, 1, 0, 0, 0};
+    memcpy(box, defaults, sizeof(defaults));
+    e = find_chunk(g, frame, "configuration/box");
+    if (e)
+        for (uint64_t k = 0; k < 6 && k < e->N * e->M; k++)
+            box[k] = (float)chunk_real(g, e, 0, k);
+}
+
+int read_gsd_frame(const gsd_file *g, long long frame,
+                   float **x, float **y, float **z,
+                   float **vx, float **vy, float **vz,
+                   int **ix, int **iy, int **iz,
+                   uint16_t **types, std::vector<std::string> *type_names,
+                   int *n_particles,
+                   bond **bonds, int *n_bonds,
+                   float *lx, float *ly, float *lz,
+                   float *xy, float *xz, float *yz,
+                   int *dimensions,
+                   int *capacity, int *bond_capacity)
+{
+    if (frame < 0 || frame >= g->n_frames)
+    {
+        fprintf(stderr, "Frame %lld not in the GSD file (%lld frames)\n", frame, g->n_frames);
+        return 2;
+    }
+
+    const gsd_index_entry *position = find_chunk(g, frame, "particles/position");
+    if (!position || position->M != 3)
+    {
+        fprintf(stderr, "Missing required particles/position chunk\n");
+        return 2;
+    }
+
+    long long n_rows = frame_particles(g, frame, position);
+    if (n_rows > INT_MAX)
+    {
+        fprintf(stderr, "Frame of %lld particles: too many to read whole\n", n_rows);
+        return 2;
+    }
+    int n = (int)n_rows;
+    *n_particles = n;
+
+    float box[6];
+    frame_box(g, frame, box, dimensions);
+    *lx = box[0]; *ly = box[1]; *lz = box[2];
+    *xy = box[3]; *xz = box[4]; *yz = box[5];
+
+    float **columns[6] = {x, y, z, vx, vy, vz};
+    for (int a = 0; a < 6; a++)
+        reserve_array(columns[a], n, capacity);
+    int **images[3] = {ix, iy, iz};
+    for (int a = 0; a < 3; a++)
+        reserve_array(images[a], n, capacity);
+    reserve_array(types, n, capacity);
+    if (capacity && n > *capacity)
+        *capacity = n;
+
+    read_column(g, position, n, 0, *x);
+    read_column(g, position, n, 1, *y);
+    read_column(g, position, n, 2, *z);
+    const gsd_index_entry *e = find_chunk(g, frame, "particles/velocity");
+    read_column(g, e, n, 0, *vx);
+    read_column(g, e, n, 1, *vy);
+    read_column(g, e, n, 2, *vz);
+    e = find_chunk(g, frame, "particles/image");
+    read_int_column(g, e, n, 0, *ix);
+    read_int_column(g, e, n, 1, *iy);
+    read_int_column(g, e, n, 2, *iz);
+
+    std::vector<uint16_t> type_of_row = particle_type_ids(g, frame, type_names);
+
+    for (int i = 0; i < n; i++)
+        (*types)[i] = type_of_row[0];
+    e = find_chunk(g, frame, "particles/typeid");
+    if (e)
+    {
+        int rows = e->N < (uint64_t)n ? (int)e->N : n;
+        for (int i = 0; i < rows; i++)
+        {
+            long long t = chunk_int(g, e, i, 0);
+            (*types)[i] = type_of_row[t >= 0 && t < (long long)type_of_row.size() ? t : 0];
+        }
+    }
+
+    // Bonds "<typei>-<typej>" as in the XML files
+    std::vector<std::string> bond_types = chunk_strings(g, find_chunk(g, frame, "bonds/types"));
+    std::vector<uint16_t> bond_typei(bond_types.size()), bond_typej(bond_types.size());
+    for (size_t b = 0; b < bond_types.size(); b++)
+    {
+        size_t dash = bond_types[b].find('-');
+        std::string ti = dash == std::string::npos ? bond_types[b] : bond_types[b].substr(0, dash);
+        std::string tj = dash == std::string::npos ? bond_types[b] : bond_types[b].substr(dash + 1);
+        bond_typei[b] = intern_name(type_names, ti);
+        bond_typej[b] = intern_name(type_names, tj);
+    }
+
+    e = find_chunk(g, frame, "bonds/N");
+    const gsd_index_entry *group = find_chunk(g, frame, "bonds/group");
+    int nb = e ? (int)chunk_int(g, e, 0, 0) : (group ? (int)group->N : 0);
+    if (!group || group->M != 2 || group->N < (uint64_t)nb)
+        nb = 0;
+    const gsd_index_entry *bond_typeid = find_chunk(g, frame, "bonds/typeid");
+    *n_bonds = nb;
+    reserve_array(bonds, nb, bond_capacity);
+    if (bond_capacity && nb > *bond_capacity)
+        *bond_capacity = nb;
+    for (int b = 0; b < nb; b++)
+    {
+        long long t = bond_typeid && (uint64_t)b < bond_typeid->N ? chunk_int(g, bond_typeid, b, 0) : 0;
+        bond *bd = &(*bonds)[b];
+        bd->ai = (int)chunk_int(g, group, b, 0);
+        bd->aj = (int)chunk_int(g, group, b, 1);
+        if (t >= 0 && t < (long long)bond_types.size())
+        {
+            bd->typei = bond_typei[t];
+            bd->typej = bond_typej[t];
+        }
+        else
+        {
+            // Unnamed bond type: use the particle types of its ends
+            bd->typei = bd->ai >= 0 && bd->ai < n ? (*types)[bd->ai] : 0;
+            bd->typej = bd->aj >= 0 && bd->aj < n ? (*types)[bd->aj] : 0;
+        }
+    }
+    return 0;
+}
+
+int open_gsd_particles(const gsd_file *g, long long frame, gsd_particle_stream *ps,
+                       std::vector<std::string> *type_names,
+                       float *lx, float *ly, float *lz, int *dimensions)
+{
+    if (frame < 0 || frame >= g->n_frames)
+    {
+        fprintf(stderr, "Frame %lld not in the GSD file (%lld frames)\n", frame, g->n_frames);
+        return 2;
+    }
+
+    ps->g = g;
+    ps->position = find_chunk(g, frame, "particles/position");
+    if (!ps->position || ps->position->M != 3)
+    {
+        fprintf(stderr, "Missing required particles/position chunk\n");
+        return 2;
+    }
+
+    ps->n_particles = frame_particles(g, frame, ps->position);
+    ps->typeid_ = find_chunk(g, frame, "particles/typeid");
+    ps->type_of_row = particle_type_ids(g, frame, type_names);
+
+    float box[6];
+    frame_box(g, frame, box, dimensions);
+    *lx = box[0]; *ly = box[1]; *lz = box[2];
+    return 0;
+}
+
+// Gives the pages of the mapping wholly inside rows [first, first + count)
+// of a chunk back to the kernel; they are read again from the file if
+// touched later
+static void drop_rows(const gsd_file *g, const gsd_index_entry *e, long long first, long long count)
+{
+    static const size_t page = sysconf(_SC_PAGESIZE);
+    size_t row = e->M * type_size(e->type);
+    size_t begin = e->location + first * row, end = begin + count * row;
+    begin = (begin + page - 1) / page * page;
+    end = end / page * page;
+    if (end > begin)
+        madvise((void *)(g->data + begin), end - begin, MADV_DONTNEED);
+}
+
+void read_gsd_particles(const gsd_particle_stream *ps, long long first, int count,
+                        float *x, float *y, float *z, uint16_t *types)
+{
+    const gsd_file *g = ps->g;
+    const gsd_index_entry *position = ps->position;
+    if (position->type == GSD_TYPE_FLOAT)
+    {
+        const float *src = (const float *)(g->data + position->location) + 3 * first;
+        for (int i = 0; i < count; i++)
+        {
+            x[i] = src[3 * i];
+            y[i] = src[3 * i + 1];
+            z[i] = src[3 * i + 2];
+        }
+    }
+    else
+    {
+        for (int i = 0; i < count; i++)
+        {
+            x[i] = (float)chunk_real(g, position, first + i, 0);
+            y[i] = (float)chunk_real(g, position, first + i, 1);
+            z[i] = (float)chunk_real(g, position, first + i, 2);
+        }
+    }
+    drop_rows(g, position, first, count);
+
+    const gsd_index_entry *e = ps->typeid_;
+    long long rows = !e ? 0 : (long long)e->N - first;
+    rows = rows < 0 ? 0 : rows < count ? rows : count;
+    for (long long i = 0; i < rows; i++)
+    {
+        long long t = chunk_int(g, e, first + i, 0);
+        types[i] = ps->type_of_row[t >= 0 && t < (long long)ps->type_of_row.size() ? t : 0];
+    }
+    for (long long i = rows; i < count; i++)
+        types[i] = ps->type_of_row[0];
+    if (rows > 0)
+        drop_rows(g, e, first, rows);
+}
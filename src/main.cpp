@@ -1,31 +1,93 @@
 #include <cstdio>
 #include <cstring>
 #include <cstdlib>
+#include <cmath>
 #include <iostream>
 #include <fstream>
 #include <string>
 #include <vector>
 #include <map>
 #include <algorithm>
-#include <filesystem>
 #include "parser.h"
 #include "clustering.h"
+#include "timing.h"
+#include "frame.h"
+#include "pipeline.h"
+#include "gsd_reader.h"
+#include "pair_kernel.h"
+#include "cell_list.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// clusterfiles_* outputs of one selection (type and layer, or molecules):
+// the index of the cluster files, or with --stats-only the trajectory
+// summary (clout_ana2 .summary rows), histogram and largest-cluster files
+struct index_output {
+    std::ofstream index;
+    std::ofstream hist, largest;
+};
+
+static void open_index(index_output *out, const std::string &base, bool stats_only)
+{
+    if (!stats_only) {
+        out->index.open(base + ".txt");
+        return;
+    }
+    out->index.open(base + ".summary");
+    out->index << "# index NClusters minSize maxSize averageSize cls_filename\n";
+    out->hist.open(base + ".hist");
+    out->hist << "# index size count\n";
+    out->largest.open(base + ".largest_cluster");
+    out->largest << "# index size ids\n";
+}
+
+static void write_index(index_output *out, const std::string &line,
+                        const std::string &hist, const std::string &largest)
+{
+    if (!out->index.is_open())
+        return;
+    out->index << line;
+    if (out->hist.is_open())
+        out->hist << hist;
+    if (out->largest.is_open())
+        out->largest << largest;
+}
+
+static void close_index(index_output *out)
+{
+    out->index.close();
+    out->hist.close();
+    out->largest.close();
+}
 
 int main(int argc, char **argv) {
     if (argc < 6) {
-        printf("Usage: %s --xml system.xml --cut <float> --types <str> ... <str> --up_down_layers --up_layer --down_layer --pbc --com\n", argv[0]);
+        printf("Usage: %s --xml system.xml ... --gsd traj.gsd [first:last[:stride]] --cut <float> ... <float> --cut_range <lo:hi:step> --types <str> ... <str> --up_down_layers --up_layer --down_layer --molecules --pbc --com --brute_force --verlet <skin> --slabs <int> --binary --compress --stats-only --threads <int> --schedule <static|dynamic|guided> [chunk] --reorder <none|morton|hilbert> --readers <int> --workers <int> --queue_depth <int> --metrics <file.jsonl>\n", argv[0]);
         return 1;
     }
 
     std::vector<std::string> considered_types;
-    std::vector<std::string> input_files;
+    std::vector<snapshot_source> input_files;
     bool up_layer = false;
     bool down_layer = false;
     bool all = true;
+    bool molecules = false;
     bool use_pbc = false;
     bool calc_com = false;
+    neighbor_engine engine = NEIGHBOR_CELL_LIST;
+    float verlet_skin = 0;
+    int n_slabs = 0;
+    int n_threads = 0;
+    cluster_format format = CLUSTER_TEXT;
+    pipeline_options popt;
+    popt.n_readers = 1;
+    popt.n_workers = 1;
+    popt.queue_depth = 0;
     
     float cluster_cutoff = 1.0;
+    std::vector<float> cutoffs;
+    std::string metrics_path;
 
     for ( int i = 1; i < argc;) {
         std::cout<<"argv[" << i <<"] "<<argv[i]<< std::endl;
@@ -33,6 +95,21 @@ int main(int argc, char **argv) {
             for (++i; i < argc && argv[i][0] != '-'; ++i) { // Skip non-option arguments
             std::cout<<"cut argv[" << i <<"] "<<argv[i]<< std::endl;
                 cluster_cutoff = atof(argv[i]);
+                cutoffs.push_back(cluster_cutoff);
+            }
+            continue;
+        } else if (!strcmp(argv[i], "--cut_range") || !strcmp(argv[i], "--cut-range")) {
+            for (++i; i < argc && argv[i][0] != '-'; ++i) { // Skip non-option arguments
+                std::cout<<"cut_range argv[" << i <<"] "<<argv[i]<< std::endl;
+                float lo, hi, step;
+                if (sscanf(argv[i], "%f:%f:%f", &lo, &hi, &step) != 3 || !(step > 0) || hi < lo) {
+                    fprintf(stderr, "Invalid cut-off range: %s (expected lo:hi:step)\n", argv[i]);
+                    return 1;
+                }
+                int n = (int)floor((hi - lo) / step + 1e-4) + 1;
+                for (int k = 0; k < n; k++)
+                    cutoffs.push_back((float)(lo + (double)k * step));
+                cluster_cutoff = cutoffs.back();
             }
             continue;
         } else if (!strcmp(argv[i], "--types")) {
@@ -44,9 +121,34 @@ int main(int argc, char **argv) {
         } else if (!strcmp(argv[i], "--xml")) {
             for (++i; i < argc && argv[i][0] != '-'; ++i) { // Skip non-option arguments
                 std::cout<<"xml argv[" << i <<"] "<<argv[i]<< std::endl;
-                input_files.push_back(argv[i]);
+                input_files.push_back({argv[i], -1});
             }
             continue;
+        } else if (!strcmp(argv[i], "--gsd")) {
+            std::string gsd_path;
+            long long first = 0, last = -1, stride = 1;
+            int k = 0;
+            for (++i; i < argc && argv[i][0] != '-'; ++i, ++k) { // Skip non-option arguments
+                std::cout<<"gsd argv[" << i <<"] "<<argv[i]<< std::endl;
+                if (k == 0)
+                    gsd_path = argv[i];
+                else if (sscanf(argv[i], "%lld:%lld:%lld", &first, &last, &stride) < 1 || stride < 1) {
+                    fprintf(stderr, "Invalid frame range: %s (expected first:last[:stride])\n", argv[i]);
+                    return 1;
+                }
+            }
+            gsd_file g;
+            if (gsd_path.empty() || !open_gsd(gsd_path.c_str(), &g)) {
+                fprintf(stderr, "Cannot read GSD file: %s\n", gsd_path.c_str());
+                return 1;
+            }
+            if (last < 0 || last >= g.n_frames)
+                last = g.n_frames - 1;
+            std::cout<<"GSD frames: " << g.n_frames << std::endl;
+            close_gsd(&g);
+            for (long long f = first; f <= last; f += stride)
+                input_files.push_back({gsd_path, f});
+            continue;
         } else if (!strcmp(argv[i], "--up_down_layers")) {
             for (++i; i < argc && argv[i][0] != '-'; ++i) { // Skip non-option arguments
                 std::cout<<"xml argv[" << i <<"] "<<argv[i]<< std::endl;
@@ -69,6 +171,12 @@ int main(int argc, char **argv) {
             down_layer = true;
             all = false;
             continue;
+        } else if (!strcmp(argv[i], "--molecules")) {
+            for (++i; i < argc && argv[i][0] != '-'; ++i) { // Skip non-option arguments
+                std::cout<<"xml argv[" << i <<"] "<<argv[i]<< std::endl;
+            }
+            molecules = true;
+            continue;
         } else if (!strcmp(argv[i], "--pbc")) {
             for (++i; i < argc && argv[i][0] != '-'; ++i) { // Skip non-option arguments
                 std::cout<<"xml argv[" << i <<"] "<<argv[i]<< std::endl;
@@ -81,166 +189,236 @@ int main(int argc, char **argv) {
             }
             calc_com = true;
             continue;
+        } else if (!strcmp(argv[i], "--brute_force")) {
+            for (++i; i < argc && argv[i][0] != '-'; ++i) { // Skip non-option arguments
+                std::cout<<"xml argv[" << i <<"] "<<argv[i]<< std::endl;
+            }
+            engine = NEIGHBOR_BRUTE_FORCE;
+            continue;
+        } else if (!strcmp(argv[i], "--verlet")) {
+            for (++i; i < argc && argv[i][0] != '-'; ++i) { // Skip non-option arguments
+                std::cout<<"verlet argv[" << i <<"] "<<argv[i]<< std::endl;
+                verlet_skin = atof(argv[i]);
+            }
+            continue;
+        } else if (!strcmp(argv[i], "--slabs")) {
+            for (++i; i < argc && argv[i][0] != '-'; ++i) { // Skip non-option arguments
+                std::cout<<"slabs argv[" << i <<"] "<<argv[i]<< std::endl;
+                n_slabs = std::max(1, atoi(argv[i]));
+            }
+            continue;
+        } else if (!strcmp(argv[i], "--binary")) {
+            for (++i; i < argc && argv[i][0] != '-'; ++i) { // Skip non-option arguments
+                std::cout<<"xml argv[" << i <<"] "<<argv[i]<< std::endl;
+            }
+            if (format == CLUSTER_TEXT)
+                format = CLUSTER_BINARY;
+            continue;
+        } else if (!strcmp(argv[i], "--compress")) {
+            for (++i; i < argc && argv[i][0] != '-'; ++i) { // Skip non-option arguments
+                std::cout<<"xml argv[" << i <<"] "<<argv[i]<< std::endl;
+            }
+            if (format != CLUSTER_STATS_ONLY)
+                format = CLUSTER_BINARY_COMPRESSED;
+            continue;
+        } else if (!strcmp(argv[i], "--stats-only") || !strcmp(argv[i], "--stats_only")) {
+            for (++i; i < argc && argv[i][0] != '-'; ++i) { // Skip non-option arguments
+                std::cout<<"xml argv[" << i <<"] "<<argv[i]<< std::endl;
+            }
+            format = CLUSTER_STATS_ONLY;
+            continue;
+        } else if (!strcmp(argv[i], "--threads")) {
+            for (++i; i < argc && argv[i][0] != '-'; ++i) { // Skip non-option arguments
+                std::cout<<"threads argv[" << i <<"] "<<argv[i]<< std::endl;
+                n_threads = atoi(argv[i]);
+            }
+            continue;
+        } else if (!strcmp(argv[i], "--schedule")) {
+            pair_schedule kind = SCHEDULE_DYNAMIC;
+            int chunk = 0;
+            int k = 0;
+            for (++i; i < argc && argv[i][0] != '-'; ++i, ++k) { // Skip non-option arguments
+                std::cout<<"schedule argv[" << i <<"] "<<argv[i]<< std::endl;
+                if (k > 0)
+                    chunk = atoi(argv[i]);
+                else if (!strcmp(argv[i], "static"))
+                    kind = SCHEDULE_STATIC;
+                else if (!strcmp(argv[i], "dynamic"))
+                    kind = SCHEDULE_DYNAMIC;
+                else if (!strcmp(argv[i], "guided"))
+                    kind = SCHEDULE_GUIDED;
+                else {
+                    fprintf(stderr, "Invalid schedule: %s\n", argv[i]);
+                    return 1;
+                }
+            }
+            set_pair_schedule(kind, chunk);
+            continue;
+        } else if (!strcmp(argv[i], "--reorder")) {
+            for (++i; i < argc && argv[i][0] != '-'; ++i) { // Skip non-option arguments
+                std::cout<<"reorder argv[" << i <<"] "<<argv[i]<< std::endl;
+                if (!strcmp(argv[i], "none"))
+                    set_cell_order(CELL_ORDER_ROW_MAJOR);
+                else if (!strcmp(argv[i], "morton"))
+                    set_cell_order(CELL_ORDER_MORTON);
+                else if (!strcmp(argv[i], "hilbert"))
+                    set_cell_order(CELL_ORDER_HILBERT);
+                else {
+                    fprintf(stderr, "Invalid reorder: %s\n", argv[i]);
+                    return 1;
+                }
+            }
+            continue;
+        } else if (!strcmp(argv[i], "--readers")) {
+            for (++i; i < argc && argv[i][0] != '-'; ++i) { // Skip non-option arguments
+                std::cout<<"readers argv[" << i <<"] "<<argv[i]<< std::endl;
+                popt.n_readers = std::max(1, atoi(argv[i]));
+            }
+            continue;
+        } else if (!strcmp(argv[i], "--workers")) {
+            for (++i; i < argc && argv[i][0] != '-'; ++i) { // Skip non-option arguments
+                std::cout<<"workers argv[" << i <<"] "<<argv[i]<< std::endl;
+                popt.n_workers = std::max(1, atoi(argv[i]));
+            }
+            continue;
+        } else if (!strcmp(argv[i], "--queue_depth")) {
+            for (++i; i < argc && argv[i][0] != '-'; ++i) { // Skip non-option arguments
+                std::cout<<"queue_depth argv[" << i <<"] "<<argv[i]<< std::endl;
+                popt.queue_depth = atoi(argv[i]);
+            }
+            continue;
+        } else if (!strcmp(argv[i], "--metrics")) {
+            for (++i; i < argc && argv[i][0] != '-'; ++i) { // Skip non-option arguments
+                std::cout<<"metrics argv[" << i <<"] "<<argv[i]<< std::endl;
+                metrics_path = argv[i];
+            }
+            continue;
         } else {
             fprintf(stderr, "Invalid option: %s\n", argv[i]);
             return 1;
         }
     }
 
-    std::map<std::string, std::ofstream> all_files_output, up_files_output, down_files_output;
-    if (all)
+#ifdef _OPENMP
+    if (n_threads > 0)
+        omp_set_num_threads(n_threads);
+    n_threads = omp_get_max_threads();
+    std::cout<<"Threads: " << n_threads << std::endl;
+#else
+    if (n_threads > 1)
+        fprintf(stderr, "Built without OpenMP, --threads ignored\n");
+    std::cout<<"Threads: 1" << std::endl;
+#endif
+    std::cout<<"Pair kernel: " << pair_kernel_isa() << std::endl;
+
+    phase_timings total_timings;
+    reset_timings(&total_timings);
+    long long verlet_frames = 0, verlet_builds = 0;
+
+    // Several cut-offs are swept in one neighbour search per snapshot
+    std::sort(cutoffs.begin(), cutoffs.end());
+    cutoffs.erase(std::unique(cutoffs.begin(), cutoffs.end()), cutoffs.end());
+    // A cut-off sweep writes its own statistics and no cluster files, so
+    // neither the index nor the --stats-only files
+    bool sweep = cutoffs.size() > 1;
+    bool stats_only = format == CLUSTER_STATS_ONLY;
+    std::map<std::string, index_output> all_files_output, up_files_output, down_files_output;
+    if (all && !sweep)
     for (const auto &t : considered_types)
-        all_files_output[t].open("clusterfiles_all_particles_type_"+ t +".txt");
-    if (up_layer)
+        open_index(&all_files_output[t], "clusterfiles_all_particles_type_"+ t, stats_only);
+    if (up_layer && !sweep)
     for (const auto &t : considered_types)
-        up_files_output[t].open("clusterfiles_up_layer_particles_type_"+ t +".txt");
-    if (down_layer)
+        open_index(&up_files_output[t], "clusterfiles_up_layer_particles_type_"+ t, stats_only);
+    if (down_layer && !sweep)
     for (const auto &t : considered_types)
-        down_files_output[t].open("clusterfiles_down_layer_particles_type_"+ t +".txt");
-
-    for ( std::string &file : input_files) {
-        std::filesystem::path path(file);
-        if (!std::filesystem::exists(path)) {
-            fprintf(stderr, "File not found: %s! skipping...\n", path.string().c_str());
-            continue;
-        }
-
-        std::cout<<"System: " << path.string() << std::endl;
-        std::cout<<"Cut-off: " << cluster_cutoff << std::endl;
-        std::cout<<"Types: ";
-        for (const auto &t : considered_types)
-            std::cout << t << " ";
-        std::cout<<std::endl;
-
-        float *x, *y, *z;
-        float *vx, *vy, *vz;
-        char **types;
-        bond *bonds;
-        int n_particles, n_bonds;
-        float lx = 0, ly = 0, lz = 0, xy = 0, xz = 0, yz = 0;
-        std::string xmlfilename = path.string();
-        
-        if (parse_hoomd_xml(path.string().c_str(), 
-                            &x, &y, &z, 
-                            &vx, &vy, &vz, 
-                            &types, 
-                            &n_particles,
-                            &bonds, &n_bonds,
-                            &lx, &ly, &lz, &xy, &xz, &yz) != 0) {
-            fprintf(stderr, "Error during parsing: %s! skipping...\n", path.string().c_str());
-            continue;
-        }   
-        int n_types = considered_types.size();
-
-        std::map<std::string,std::vector<float>> x_map, y_map, z_map, x_up, y_up, z_up, x_down, y_down, z_down;
-        std::map<std::string,std::vector<int>> andx_map, andx_up, andx_down;
-
-        if (calc_com) {
-            float x_com = 0, y_com = 0, z_com = 0;
-            for (int i = 0; i < n_particles; i++) {
-                x_com += x[i];
-                y_com += y[i];
-                z_com += z[i];
-            }
-
-            x_com /= n_particles;
-            y_com /= n_particles;
-            z_com /= n_particles;
-
-            for (int i = 0; i < n_particles; i++) {
-                x[i] -= x_com;
-                y[i] -= y_com;
-                z[i] -= z_com;
-            }
-        }
-        
-        for (int i = 0; i < n_particles; i++) {
-            std::string type = types[i];
-            x_map[types[i]].push_back(x[i]);
-            y_map[types[i]].push_back(y[i]);
-            z_map[types[i]].push_back(z[i]);
-            andx_map[types[i]].push_back(i);
-        } 
-
-        if (!all)
-        for (int ib=0; ib < n_bonds; ib++) {
-            std::string typei = bonds[ib].typei, typej = bonds[ib].typej;
-            int ai = bonds[ib].ai, aj = bonds[ib].aj, hndx = 0;
-            std::string htype;
-            float xhead, yhead, zhead, xtail, ytail, ztail;
-            if (std::find(considered_types.begin(), considered_types.end(),typei) != considered_types.end()) {
-                xhead = x[ai]; yhead = y[ai]; zhead = z[ai]; hndx = ai; htype = typei;
-                xtail = x[aj]; ytail = y[aj]; ztail = z[aj];
-            } else if (std::find(considered_types.begin(), considered_types.end(),typej) != considered_types.end()) {
-                xhead = x[aj]; yhead = y[aj]; zhead = z[aj]; hndx = aj; htype = typej;
-                xtail = x[ai]; ytail = y[ai]; ztail = z[ai];
-            } else {
-                continue;
-            }
-            float dx = xhead - xtail, dy = yhead - ytail, dz = zhead - ztail;
-            float dx_dot_rhead = dx * xhead + dy * yhead + dz * zhead;
-            if (dx_dot_rhead > 0 && up_layer) {
-                x_up[htype].push_back(xhead); y_up[htype].push_back(yhead); z_up[htype].push_back(zhead);
-                andx_up[htype].push_back(hndx);
-            } else if ( down_layer ) {
-                x_down[htype].push_back(xhead); y_down[htype].push_back(yhead); z_down[htype].push_back(zhead);
-                andx_down[htype].push_back(hndx);
-            }
-
-        }
-        // You can convert float** -> double** if needed for clustering
-        // Example usage of `neighboring()` goes here if positions are passed
+        open_index(&down_files_output[t], "clusterfiles_down_layer_particles_type_"+ t, stats_only);
+    index_output molecules_output;
+    if (molecules && !sweep)
+        open_index(&molecules_output, "clusterfiles_molecules", stats_only);
+    // One JSON object per snapshot, then a summary (--metrics)
+    FILE *metrics_output = NULL;
+    if (!metrics_path.empty() && !(metrics_output = fopen(metrics_path.c_str(), "w"))) {
+        fprintf(stderr, "Cannot write metrics file: %s\n", metrics_path.c_str());
+        return 1;
+    }
+    long long n_frames = 0;
 
-        printf("Parsed %d particles.\n", n_particles);
-        printf("Parsed %d bonds.\n", n_bonds);
+    run_options opt;
+    opt.considered_types = considered_types;
+    opt.cluster_cutoff = cluster_cutoff;
+    if (cutoffs.size() > 1)
+        opt.sweep_cutoffs = cutoffs;
+    opt.all = all;
+    opt.up_layer = up_layer;
+    opt.down_layer = down_layer;
+    opt.molecules = molecules;
+    opt.use_pbc = use_pbc;
+    opt.calc_com = calc_com;
+    opt.engine = engine;
+    opt.verlet_skin = verlet_skin;
+    if (verlet_skin > 0 && (!all || opt.sweep_cutoffs.size() > 0))
+        fprintf(stderr, "--verlet applies to single cut-off runs over whole types only, ignored\n");
+    opt.format = format;
+    opt.metrics = metrics_output != NULL;
+    opt.n_slabs = n_slabs;
+    if (n_slabs > 0 && (!all || up_layer || down_layer || molecules || opt.sweep_cutoffs.size() > 0)) {
+        fprintf(stderr, "--slabs applies to single cut-off runs over whole types only, ignored\n");
+        opt.n_slabs = 0;
+    } else if (n_slabs > 0 && (calc_com || opt.verlet_skin > 0)) {
+        fprintf(stderr, "--com and --verlet do not apply to --slabs runs, ignored\n");
+    }
+    set_cluster_format(format);
 
-        path.replace_extension().filename();
+    popt.threads_per_worker = std::max(1, n_threads / popt.n_workers);
+    if (popt.queue_depth <= 0)
+        popt.queue_depth = 2 * popt.n_workers;
 
-        for (int i = 0; i < n_types; i++) {
-            std::string ptype = considered_types[i];
-            std::cout << "Type " << ptype ;
-            if ( all )
-            std::cout << " all: "<< x_map[ptype].size();
-            if ( up_layer )
-            std::cout << " upper layer: "<< x_up[ptype].size();
-            if ( down_layer )
-            std::cout << "  down layer: "<< x_down[ptype].size();
-            std::cout << std::endl;
-            
-            std::string filename;
-            if (all) {
-                filename = path.filename().string() + "_type_" + ptype + "_neighboring.txt";
-                neighboring_particles(x_map[ptype].data(), y_map[ptype].data(), z_map[ptype].data(), cluster_cutoff, x_map[ptype].size(), 32, lx, ly, lz, andx_map[ptype].data(),filename.c_str(), use_pbc);
-                all_files_output[ptype] << filename <<'\t'<<xmlfilename<<'\t'<<ptype<< "all" <<'\t'<<'\n';
-            }
-            
-            if ( up_layer ) {
-                filename = path.filename().string() + "_up_type_" + ptype + "_neighboring.txt";
-                neighboring_particles(x_up[ptype].data(), y_up[ptype].data(), z_up[ptype].data(), cluster_cutoff, x_up[ptype].size(), 32, lx, ly, lz, andx_up[ptype].data(),filename.c_str(),use_pbc);
-                up_files_output[ptype] << filename <<'\t'<<xmlfilename<<'\t'<<ptype<<'\t'<< "up" <<'\n';
-            }
-            
-            if ( down_layer ) {
-                filename = path.filename().string() + "_down_type_" + ptype + "_neighboring.txt";
-                neighboring_particles(x_down[ptype].data(), y_down[ptype].data(), z_down[ptype].data(), cluster_cutoff, x_down[ptype].size(), 32, lx, ly, lz, andx_down[ptype].data(),filename.c_str(),use_pbc);
-                down_files_output[ptype] << filename <<'\t'<<xmlfilename<<'\t'<<ptype<<'\t'<< "down" << '\n';
-            }
+    init_parser();
+    double run_start = wall_time();
+    run_pipeline(opt, popt, input_files, [&](frame_result &r) {
+        fputs(r.errors.c_str(), stderr);
+        fputs(r.log.c_str(), stdout);
+        fflush(stdout);
+        for (size_t i = 0; i < considered_types.size(); i++) {
+            const std::string &t = considered_types[i];
+            if (all)
+                write_index(&all_files_output[t], r.all_lines[i], r.all_hist[i], r.all_largest[i]);
+            if (up_layer)
+                write_index(&up_files_output[t], r.up_lines[i], r.up_hist[i], r.up_largest[i]);
+            if (down_layer)
+                write_index(&down_files_output[t], r.down_lines[i], r.down_hist[i], r.down_largest[i]);
         }
-        for (int i = 0; i < n_particles; i++) free(types[i]);
-        free(x); free(y); free(z);
-        free(vx); free(vy); free(vz);
-        free(types);
-    }
+        if (molecules)
+            write_index(&molecules_output, r.molecules_line, r.molecules_hist, r.molecules_largest);
+        if (metrics_output)
+            fputs(r.metrics_line.c_str(), metrics_output);
+        add_timings(&total_timings, &r.timings);
+        n_frames++;
+        verlet_frames += r.verlet_used;
+        verlet_builds += r.verlet_rebuilt;
+    });
     
+    print_timings(stdout, "Total timings:", &total_timings);
+    if (verlet_frames > 0)
+        printf("Verlet list rebuilds: %lld of %lld frames (rate %.3f)\n",
+               verlet_builds, verlet_frames, (double)verlet_builds / verlet_frames);
+    if (metrics_output) {
+        fprintf(metrics_output, "{\"summary\": true, \"frames\": %lld, \"wall_seconds\": %.6f, %s, \"peak_rss_kb\": %ld}\n",
+                n_frames, wall_time() - run_start, format_metrics_json(&total_timings).c_str(), peak_rss_kb());
+        fclose(metrics_output);
+    }
+
     if (all)
     for (const auto &t : considered_types)
-        all_files_output[t].close();
+        close_index(&all_files_output[t]);
     if (up_layer)
     for (const auto &t : considered_types)
-        up_files_output[t].close();
+        close_index(&up_files_output[t]);
     if (down_layer)
     for (const auto &t : considered_types)
-        down_files_output[t].close();
+        close_index(&down_files_output[t]);
+    if (molecules)
+        close_index(&molecules_output);
 
     return 0;
 }
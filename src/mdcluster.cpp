@@ -0,0 +1,92 @@
+#include <stdlib.h>
+#include "mdcluster.h"
+
+void init_cluster_result(cluster_result *r)
+{
+    r->n = r->n_clusters = 0;
+    r->n_links = 0;
+    r->labels = r->offsets = r->members = NULL;
+    r->capacity = 0;
+    r->owned = true;
+}
+
+void wrap_cluster_result(cluster_result *r, int *labels, int *offsets, int *members, int capacity)
+{
+    init_cluster_result(r);
+    r->labels = labels;
+    r->offsets = offsets;
+    r->members = members;
+    r->capacity = capacity;
+    r->owned = false;
+}
+
+void free_cluster_result(cluster_result *r)
+{
+    if (r->owned)
+    {
+        free(r->labels);
+        free(r->offsets);
+        free(r->members);
+    }
+    init_cluster_result(r);
+}
+
+// Room for n entries; false if the caller's buffers are too small
+static bool reserve_result(cluster_result *r, int n)
+{
+    if (r->offsets && n <= r->capacity)
+        return true;
+    if (!r->owned)
+        return false;
+    free(r->labels);
+    free(r->offsets);
+    free(r->members);
+    r->labels = (int *)malloc(sizeof(int) * (n > 0 ? n : 1));
+    r->offsets = (int *)malloc(sizeof(int) * (n + 1));
+    r->members = (int *)malloc(sizeof(int) * (n > 0 ? n : 1));
+    r->capacity = n;
+    return true;
+}
+
+int cluster_particles(const float *x, const float *y, const float *z, int n,
+                      const cluster_box &box, const cluster_options &opt,
+                      cluster_result *r, phase_timings *timings, frame_arena *arena)
+{
+    if (!reserve_result(r, n))
+        return 1;
+    if (arena)
+        arena_reset(arena);
+
+    int sel_start[2] = {0, n};
+    const char *name = "";
+    int n_links;
+    concurrent_union_find uf;
+    link_selections(x, y, z, opt.cutoff, 1, sel_start, box.lx, box.ly, box.lz, &name,
+                    box.periodic, box.dimensions, opt.engine, &uf, &n_links, timings, arena);
+    r->n = n;
+    r->n_links = n_links;
+    scoped_phase timer(timings, PHASE_CLUSTERS);
+    r->n_clusters = cluster_labels(&uf, 0, n, r->labels, r->offsets, r->members, arena);
+    cuf_free(&uf);
+    return 0;
+}
+
+int cluster_molecules(const float *x, const float *y, const float *z,
+                      int n_molecules, const int *mol_start,
+                      const cluster_box &box, const cluster_options &opt,
+                      cluster_result *r, phase_timings *timings, frame_arena *arena)
+{
+    if (!reserve_result(r, n_molecules))
+        return 1;
+    if (arena)
+        arena_reset(arena);
+
+    concurrent_union_find uf;
+    r->n = n_molecules;
+    r->n_links = link_molecules(x, y, z, opt.cutoff, n_molecules, mol_start, box.lx, box.ly, box.lz,
+                                box.periodic, box.dimensions, opt.engine, &uf, timings, arena);
+    scoped_phase timer(timings, PHASE_CLUSTERS);
+    r->n_clusters = cluster_labels(&uf, 0, n_molecules, r->labels, r->offsets, r->members, arena);
+    cuf_free(&uf);
+    return 0;
+}
@@ -0,0 +1,57 @@
+#include <stdlib.h>
+#include <string.h>
+#include "union_find.h"
+#include "molecule.h"
+
+void build_molecules(molecule_index *mi, int n_particles, const bond *bonds, int n_bonds)
+{
+    union_find uf;
+    uf_init(&uf, n_particles);
+    for (int b = 0; b < n_bonds; b++)
+    {
+        int ai = bonds[b].ai, aj = bonds[b].aj;
+        if (ai >= 0 && ai < n_particles && aj >= 0 && aj < n_particles)
+            uf_union(&uf, ai, aj);
+    }
+
+    // Dense ids in order of the first (lowest) particle of every molecule
+    int size = n_particles > 0 ? n_particles : 1;
+    int *dense = (int *)malloc(sizeof(int) * size);
+    for (int i = 0; i < n_particles; i++)
+        dense[i] = -1;
+    mi->molecule_of = (int *)malloc(sizeof(int) * size);
+    mi->n_molecules = 0;
+    for (int i = 0; i < n_particles; i++)
+    {
+        int root = uf_find(&uf, i);
+        if (dense[root] < 0)
+            dense[root] = mi->n_molecules++;
+        mi->molecule_of[i] = dense[root];
+    }
+    free(dense);
+    uf_free(&uf);
+
+    // Counting sort of the particles by molecule
+    mi->mol_start = (int *)calloc(mi->n_molecules + 1, sizeof(int));
+    mi->mol_particles = (int *)malloc(sizeof(int) * size);
+    for (int i = 0; i < n_particles; i++)
+        mi->mol_start[mi->molecule_of[i] + 1]++;
+    for (int m = 0; m < mi->n_molecules; m++)
+        mi->mol_start[m + 1] += mi->mol_start[m];
+    int *fill = (int *)malloc(sizeof(int) * (mi->n_molecules > 0 ? mi->n_molecules : 1));
+    memcpy(fill, mi->mol_start, sizeof(int) * mi->n_molecules);
+    for (int i = 0; i < n_particles; i++)
+        mi->mol_particles[fill[mi->molecule_of[i]]++] = i;
+    free(fill);
+}
+
+void free_molecules(molecule_index *mi)
+{
+    free(mi->molecule_of);
+    free(mi->mol_start);
+    free(mi->mol_particles);
+    mi->molecule_of = NULL;
+    mi->mol_start = NULL;
+    mi->mol_particles = NULL;
+    mi->n_molecules = 0;
+}
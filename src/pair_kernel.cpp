@@ -0,0 +1,205 @@
+#include <math.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PAIR_KERNEL_X86 1
+#endif
+#include "pair_kernel.h"
+
+// Built with -ffp-contract=off (see CMakeLists.txt) so that no variant
+// fuses multiplies and adds: all of them round exactly like the scalar
+// reference and report the same hits.
+
+void init_pair_box(pair_box *box, float Lx, float Ly, float Lz, float dist_cluster)
+{
+    float L[3] = {Lx, Ly, Lz};
+    for (int d = 0; d < 3; d++)
+    {
+        box->L[d] = L[d];
+        box->inv_L[d] = L[d] != 0 ? 1.0f / L[d] : 0.0f;
+    }
+    box->cut2 = dist_cluster * dist_cluster;
+}
+
+template <bool PBC>
+static inline float min_image(float d, float L, float inv_L)
+{
+    if (PBC)
+        d -= L * rintf(d * inv_L);
+    return d;
+}
+
+template <bool PBC, int DIM>
+static int kernel_scalar(float x, float y, float z,
+                         const float *xs, const float *ys, const float *zs,
+                         int begin, int end, const pair_box *box, int *hits)
+{
+    int count = 0;
+    for (int b = begin; b < end; b++)
+    {
+        float dx = min_image<PBC>(x - xs[b], box->L[0], box->inv_L[0]);
+        float dy = min_image<PBC>(y - ys[b], box->L[1], box->inv_L[1]);
+        float dist2 = dx * dx + dy * dy;
+        if (DIM == 3)
+        {
+            float dz = min_image<PBC>(z - zs[b], box->L[2], box->inv_L[2]);
+            dist2 += dz * dz;
+        }
+        if (dist2 < box->cut2)
+            hits[count++] = b;
+    }
+    return count;
+}
+
+#ifdef PAIR_KERNEL_X86
+
+template <bool PBC>
+__attribute__((target("avx2")))
+static inline __m256 min_image_avx2(__m256 d, __m256 L, __m256 inv_L)
+{
+    if (PBC)
+    {
+        __m256 k = _mm256_round_ps(_mm256_mul_ps(d, inv_L), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        d = _mm256_sub_ps(d, _mm256_mul_ps(L, k));
+    }
+    return d;
+}
+
+template <bool PBC, int DIM>
+__attribute__((target("avx2")))
+static int kernel_avx2(float x, float y, float z,
+                       const float *xs, const float *ys, const float *zs,
+                       int begin, int end, const pair_box *box, int *hits)
+{
+    const __m256 px = _mm256_set1_ps(x), py = _mm256_set1_ps(y), pz = _mm256_set1_ps(z);
+    const __m256 Lx = _mm256_set1_ps(box->L[0]), iLx = _mm256_set1_ps(box->inv_L[0]);
+    const __m256 Ly = _mm256_set1_ps(box->L[1]), iLy = _mm256_set1_ps(box->inv_L[1]);
+    const __m256 Lz = _mm256_set1_ps(box->L[2]), iLz = _mm256_set1_ps(box->inv_L[2]);
+    const __m256 cut2 = _mm256_set1_ps(box->cut2);
+
+    int count = 0, b = begin;
+    for (; b + 8 <= end; b += 8)
+    {
+        __m256 dx = min_image_avx2<PBC>(_mm256_sub_ps(px, _mm256_loadu_ps(xs + b)), Lx, iLx);
+        __m256 dy = min_image_avx2<PBC>(_mm256_sub_ps(py, _mm256_loadu_ps(ys + b)), Ly, iLy);
+        __m256 dist2 = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+        if (DIM == 3)
+        {
+            __m256 dz = min_image_avx2<PBC>(_mm256_sub_ps(pz, _mm256_loadu_ps(zs + b)), Lz, iLz);
+            dist2 = _mm256_add_ps(dist2, _mm256_mul_ps(dz, dz));
+        }
+        unsigned mask = _mm256_movemask_ps(_mm256_cmp_ps(dist2, cut2, _CMP_LT_OQ));
+        while (mask)
+        {
+            hits[count++] = b + __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+    }
+    return count + kernel_scalar<PBC, DIM>(x, y, z, xs, ys, zs, b, end, box, hits + count);
+}
+
+template <bool PBC>
+__attribute__((target("avx512f")))
+static inline __m512 min_image_avx512(__m512 d, __m512 L, __m512 inv_L)
+{
+    if (PBC)
+    {
+        __m512 k = _mm512_roundscale_ps(_mm512_mul_ps(d, inv_L), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        d = _mm512_sub_ps(d, _mm512_mul_ps(L, k));
+    }
+    return d;
+}
+
+template <bool PBC, int DIM>
+__attribute__((target("avx512f")))
+static int kernel_avx512(float x, float y, float z,
+                         const float *xs, const float *ys, const float *zs,
+                         int begin, int end, const pair_box *box, int *hits)
+{
+    const __m512 px = _mm512_set1_ps(x), py = _mm512_set1_ps(y), pz = _mm512_set1_ps(z);
+    const __m512 Lx = _mm512_set1_ps(box->L[0]), iLx = _mm512_set1_ps(box->inv_L[0]);
+    const __m512 Ly = _mm512_set1_ps(box->L[1]), iLy = _mm512_set1_ps(box->inv_L[1]);
+    const __m512 Lz = _mm512_set1_ps(box->L[2]), iLz = _mm512_set1_ps(box->inv_L[2]);
+    const __m512 cut2 = _mm512_set1_ps(box->cut2);
+
+    int count = 0, b = begin;
+    for (; b + 16 <= end; b += 16)
+    {
+        __m512 dx = min_image_avx512<PBC>(_mm512_sub_ps(px, _mm512_loadu_ps(xs + b)), Lx, iLx);
+        __m512 dy = min_image_avx512<PBC>(_mm512_sub_ps(py, _mm512_loadu_ps(ys + b)), Ly, iLy);
+        __m512 dist2 = _mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy));
+        if (DIM == 3)
+        {
+            __m512 dz = min_image_avx512<PBC>(_mm512_sub_ps(pz, _mm512_loadu_ps(zs + b)), Lz, iLz);
+            dist2 = _mm512_add_ps(dist2, _mm512_mul_ps(dz, dz));
+        }
+        unsigned mask = _mm512_cmp_ps_mask(dist2, cut2, _CMP_LT_OQ);
+        while (mask)
+        {
+            hits[count++] = b + __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+    }
+    return count + kernel_avx2<PBC, DIM>(x, y, z, xs, ys, zs, b, end, box, hits + count);
+}
+
+#endif // PAIR_KERNEL_X86
+
+enum kernel_isa { ISA_SCALAR, ISA_AVX2, ISA_AVX512 };
+
+static kernel_isa detect_isa()
+{
+#ifdef PAIR_KERNEL_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return ISA_AVX512;
+    if (__builtin_cpu_supports("avx2"))
+        return ISA_AVX2;
+#endif
+    return ISA_SCALAR;
+}
+
+template <bool PBC, int DIM>
+static pair_kernel kernel_for(kernel_isa isa)
+{
+#ifdef PAIR_KERNEL_X86
+    if (isa == ISA_AVX512)
+        return kernel_avx512<PBC, DIM>;
+    if (isa == ISA_AVX2)
+        return kernel_avx2<PBC, DIM>;
+#endif
+    return kernel_scalar<PBC, DIM>;
+}
+
+float pair_kernel_dist2(float x, float y, float z,
+                        const float *xs, const float *ys, const float *zs,
+                        int b, const pair_box *box, bool use_pbc, int dimensions)
+{
+    float dx = use_pbc ? min_image<true>(x - xs[b], box->L[0], box->inv_L[0]) : x - xs[b];
+    float dy = use_pbc ? min_image<true>(y - ys[b], box->L[1], box->inv_L[1]) : y - ys[b];
+    float dist2 = dx * dx + dy * dy;
+    if (dimensions != 2)
+    {
+        float dz = use_pbc ? min_image<true>(z - zs[b], box->L[2], box->inv_L[2]) : z - zs[b];
+        dist2 += dz * dz;
+    }
+    return dist2;
+}
+
+pair_kernel select_pair_kernel(bool use_pbc, int dimensions)
+{
+    static const kernel_isa isa = detect_isa();
+    if (use_pbc)
+        return dimensions == 2 ? kernel_for<true, 2>(isa) : kernel_for<true, 3>(isa);
+    return dimensions == 2 ? kernel_for<false, 2>(isa) : kernel_for<false, 3>(isa);
+}
+
+const char *pair_kernel_isa()
+{
+    switch (detect_isa())
+    {
+    case ISA_AVX512: return "avx512";
+    case ISA_AVX2: return "avx2";
+    default: return "scalar";
+    }
+}
@@ -1,231 +1,766 @@
+#include <float.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <charconv>
+#include <string>
+#include <vector>
 #include <libxml/parser.h>
 #include <libxml/tree.h>
 #include "parser.h"
 
-int count_lines(const char *text)
+// The snapshot is read with a SAX2 push parser: the file is fed to libxml2
+// in fixed-size chunks and the text of the <position>, <velocity>, <image>,
+// <type> and <bond> blocks is tokenized as it streams by, straight into the
+// output arrays. No DOM and no copies of the text blocks are built.
+// Tokens are scanned in place in libxml2's buffer; only a token split
+// across two chunks is carried over in a small fixed buffer. Coordinates
+// and images are converted while their token is found, in one pass.
+// libxml2 alone reads about three times faster than the whole parser, so
+// number scanning is still most of the time.
+// With a topology cache the <type> and <bond> text is hashed as it streams
+// by and, once the cache is filled, not tokenized at all.
+
+#define READ_CHUNK (64 * 1024)
+#define MAX_TOKEN 64
+#define FNV_OFFSET 0xcbf29ce484222325ull
+#define FNV_PRIME 0x100000001b3ull
+
+enum xml_block {
+    BLOCK_NONE,
+    BLOCK_POSITION,
+    BLOCK_VELOCITY,
+    BLOCK_IMAGE,
+    BLOCK_TYPE,
+    BLOCK_BOND
+};
+
+struct sax_state {
+    float *x, *y, *z, *vx, *vy, *vz;
+    int *ix, *iy, *iz;
+    uint16_t *types;
+    std::vector<std::string> *type_names;
+    int last_type;              // id of the previous type line (runs are common)
+    int capacity;               // allocated length of the per-particle arrays
+    int n_positions, n_velocities, n_images, n_types;
+
+    bond *bonds;
+    int bond_capacity;
+    int n_bonds;
+    bool has_bonds;
+
+    float *lx, *ly, *lz, *xy, *xz, *yz;
+    int *dimensions;
+
+    bool read_images;
+    topology *topo;             // NULL: no topology cache
+    bool skip_topology;         // only hash <type> and <bond>
+    uint64_t type_hash, bond_hash;
+
+    xml_block block;
+    char carry[MAX_TOKEN];      // token split across two chunks
+    int carry_len;
+    int n_fields;               // tokens seen on the current line
+    bool line_ok;               // all required fields of the line scanned
+    float values[3];            // scanned fields of the current line
+    int ids[3];
+    uint16_t type, typei, typej;
+    bool out_of_memory;
+};
+
+// Grows the per-particle arrays to hold at least n entries
+static void grow_particles(sax_state *st, int n)
+{
+    int cap = st->capacity > 0 ? st->capacity : 1024;
+    while (cap < n)
+        cap *= 2;
+
+    float **arrays[6] = {&st->x, &st->y, &st->z, &st->vx, &st->vy, &st->vz};
+    for (int a = 0; a < 6; a++)
+    {
+        float *p = (float *)realloc(*arrays[a], sizeof(float) * cap);
+        if (!p)
+        {
+            st->out_of_memory = true;
+            return;
+        }
+        // Velocities default to zero when the block is missing or short
+        memset(p + st->capacity, 0, sizeof(float) * (cap - st->capacity));
+        *arrays[a] = p;
+    }
+    int **images[3] = {&st->ix, &st->iy, &st->iz};
+    for (int a = 0; a < 3; a++)
+    {
+        int *p = (int *)realloc(*images[a], sizeof(int) * cap);
+        if (!p)
+        {
+            st->out_of_memory = true;
+            return;
+        }
+        // Images default to zero (positions taken as unwrapped)
+        memset(p + st->capacity, 0, sizeof(int) * (cap - st->capacity));
+        *images[a] = p;
+    }
+    uint16_t *t = (uint16_t *)realloc(st->types, sizeof(uint16_t) * cap);
+    if (!t)
+    {
+        st->out_of_memory = true;
+        return;
+    }
+    st->types = t;
+    st->capacity = cap;
+}
+
+// Called once per line: the common case stays inline
+static inline void reserve_particles(sax_state *st, int n)
+{
+    if (n > st->capacity)
+        grow_particles(st, n);
+}
+
+static void reserve_bonds(sax_state *st, int n)
 {
-    int count = 0;
-    const char *p = text;
-    while (*p)
+    if (n <= st->bond_capacity)
+        return;
+    int cap = st->bond_capacity > 0 ? st->bond_capacity : 1024;
+    while (cap < n)
+        cap *= 2;
+    bond *b = (bond *)realloc(st->bonds, sizeof(bond) * cap);
+    if (!b)
     {
-        if (*p == '\n')
-            count++;
-        p++;
+        st->out_of_memory = true;
+        return;
     }
-    return count;
+    st->bonds = b;
+    st->bond_capacity = cap;
 }
 
-void parse_vector_components(xmlNode *node, float *x, float *y, float *z, int n_particles)
+// Powers of ten exact in a double
+static const double exact_pow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// Plain decimals "[-]digits[.digits]" as written by HOOMD, with at most
+// 15 significant digits: the mantissa and the power of ten are exact in a
+// double, so their quotient is the correctly rounded double. Rounding
+// that to a float gives the correctly rounded float unless the double
+// lies exactly halfway between two floats, which is left to from_chars
+// like exponents, long mantissas and anything unusual. Scans from begin
+// and returns where the decimal stops, or NULL if it is not handled here.
+static inline const char *scan_decimal(const char *begin, const char *end, float *v)
 {
-    xmlChar *content = xmlNodeGetContent(node);
-    char *line = strtok((char *)content, "\n");
-    int idx = 0;
+    const char *p = begin;
+    bool negative = p < end && *p == '-';
+    p += negative;
+    uint64_t mantissa = 0;
+    int digits = 0, fraction = 0;
+    for (; p < end && (unsigned)(*p - '0') < 10; p++, digits++)
+        mantissa = mantissa * 10 + (*p - '0');
+    if (p < end && *p == '.')
+    {
+        const char *dot = ++p;
+        for (; p < end && (unsigned)(*p - '0') < 10; p++, digits++)
+            mantissa = mantissa * 10 + (*p - '0');
+        fraction = (int)(p - dot);
+    }
+    if (digits == 0 || digits > 15)
+        return NULL;
+
+    double d = (double)mantissa / exact_pow10[fraction];
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof(bits));
+    // A float midpoint has the 29 bits below float precision at 1000...0;
+    // floats below the normal range round at other bits
+    if ((bits & 0x1FFFFFFFull) == 0x10000000ull || (d != 0 && d < FLT_MIN))
+        return NULL;
+    *v = (float)(negative ? -d : d);
+    return p;
+}
 
-    while (line && idx < n_particles)
+// Integers "[-]digits" of at most 9 digits (no overflow); returns where the
+// integer stops, or NULL if it is not handled here
+static inline const char *scan_small_int(const char *begin, const char *end, int *v)
+{
+    const char *p = begin;
+    bool negative = p < end && *p == '-';
+    p += negative;
+    int value = 0, digits = 0;
+    for (; p < end && (unsigned)(*p - '0') < 10; p++, digits++)
+        value = value * 10 + (*p - '0');
+    if (digits == 0 || digits > 9)
+        return NULL;
+    *v = negative ? -value : value;
+    return p;
+}
+
+// Allocation-free scanners for [begin, end); false unless a number was read
+static inline bool scan_float(const char *begin, const char *end, float *v)
+{
+    if (scan_decimal(begin, end, v) == end)
+        return true;
+    if (begin < end && *begin == '+')
+        begin++;
+    std::from_chars_result r = std::from_chars(begin, end, *v);
+    return r.ec == std::errc() && r.ptr != begin;
+}
+
+static inline bool scan_int(const char *begin, const char *end, int *v)
+{
+    if (begin < end && *begin == '+')
+        begin++;
+    std::from_chars_result r = std::from_chars(begin, end, *v);
+    return r.ec == std::errc() && r.ptr != begin;
+}
+
+// Id of the type name [begin, end), appended to the table if new.
+// Returns false once the table would exceed MAX_PARTICLE_TYPES.
+static bool intern_type(sax_state *st, const char *begin, const char *end, uint16_t *id)
+{
+    std::vector<std::string> &names = *st->type_names;
+    size_t len = end - begin;
+
+    if (st->last_type >= 0 && names[st->last_type].size() == len &&
+        !memcmp(names[st->last_type].data(), begin, len))
     {
-        float px, py, pz;
-        if (sscanf(line, "%f %f %f", &px, &py, &pz) == 3)
+        *id = (uint16_t)st->last_type;
+        return true;
+    }
+    for (size_t t = 0; t < names.size(); t++)
+    {
+        if (names[t].size() == len && !memcmp(names[t].data(), begin, len))
         {
-            x[idx] = px;
-            y[idx] = py;
-            z[idx] = pz;
-            idx++;
+            st->last_type = (int)t;
+            *id = (uint16_t)t;
+            return true;
         }
-        line = strtok(NULL, "\n");
     }
-
-    xmlFree(content);
+    if (names.size() >= MAX_PARTICLE_TYPES)
+        return false;
+    names.emplace_back(begin, len);
+    st->last_type = (int)names.size() - 1;
+    *id = (uint16_t)st->last_type;
+    return true;
 }
 
-void parse_bond_components(xmlNode *node, bond *bonds, int n_bonds)
+// Scans the n_fields-th token [begin, end) of the current line
+static void on_token(sax_state *st, const char *begin, const char *end)
 {
-    xmlChar *content = xmlNodeGetContent(node);
-    char *line = strtok((char *)content, "\n");
-    int idx = 0;
+    int field = st->n_fields++;
+    switch (st->block)
+    {
+    case BLOCK_POSITION:
+    case BLOCK_VELOCITY:
+        // "<x> <y> <z>"
+        if (field < 3)
+            st->line_ok = scan_float(begin, end, &st->values[field]) && (field == 0 || st->line_ok);
+        break;
+    case BLOCK_IMAGE:
+        // "<ix> <iy> <iz>"
+        if (field < 3)
+            st->line_ok = scan_int(begin, end, &st->ids[field]) && (field == 0 || st->line_ok);
+        break;
+    case BLOCK_TYPE:
+        if (field == 0)
+        {
+            st->line_ok = intern_type(st, begin, end, &st->type);
+        }
+        break;
+    case BLOCK_BOND:
+        // "<typei>-<typej> <ai> <aj>"
+        if (field == 0)
+        {
+            const char *dash = (const char *)memchr(begin, '-', end - begin);
+            st->line_ok = dash && dash != begin && dash + 1 != end;
+            st->line_ok = st->line_ok &&
+                          intern_type(st, begin, dash, &st->typei) &&
+                          intern_type(st, dash + 1, end, &st->typej);
+        }
+        else if (field < 3)
+            st->line_ok = scan_int(begin, end, &st->ids[field - 1]) && st->line_ok;
+        break;
+    default:
+        break;
+    }
+}
 
-    while (line && idx < n_bonds)
+// One complete line of the current block has been scanned
+static void end_line(sax_state *st)
+{
+    switch (st->block)
     {
-        int a1, a2;
-        char type1[9], type2[9];
-        int len = strlen(line);
-        for (int i = 0; i < len; i++) {
-            if (line[i] == '-') {
-                line[i] = ' ';
+    case BLOCK_POSITION:
+        if (st->n_fields >= 3 && st->line_ok)
+        {
+            reserve_particles(st, st->n_positions + 1);
+            if (st->out_of_memory)
                 break;
+            st->x[st->n_positions] = st->values[0];
+            st->y[st->n_positions] = st->values[1];
+            st->z[st->n_positions] = st->values[2];
+            st->n_positions++;
+        }
+        break;
+    case BLOCK_VELOCITY:
+        if (st->n_fields >= 3 && st->line_ok)
+        {
+            reserve_particles(st, st->n_velocities + 1);
+            if (st->out_of_memory)
+                break;
+            st->vx[st->n_velocities] = st->values[0];
+            st->vy[st->n_velocities] = st->values[1];
+            st->vz[st->n_velocities] = st->values[2];
+            st->n_velocities++;
+        }
+        break;
+    case BLOCK_IMAGE:
+        if (st->n_fields >= 3 && st->line_ok)
+        {
+            reserve_particles(st, st->n_images + 1);
+            if (st->out_of_memory)
+                break;
+            st->ix[st->n_images] = st->ids[0];
+            st->iy[st->n_images] = st->ids[1];
+            st->iz[st->n_images] = st->ids[2];
+            st->n_images++;
+        }
+        break;
+    case BLOCK_TYPE:
+        if (st->n_fields >= 1 && st->line_ok)
+        {
+            reserve_particles(st, st->n_types + 1);
+            if (st->out_of_memory)
+                break;
+            st->types[st->n_types++] = st->type;
+        }
+        break;
+    case BLOCK_BOND:
+        if (st->n_fields >= 3 && st->line_ok)
+        {
+            reserve_bonds(st, st->n_bonds + 1);
+            if (st->out_of_memory)
+                break;
+            bond *bd = &st->bonds[st->n_bonds++];
+            bd->ai = st->ids[0];
+            bd->aj = st->ids[1];
+            bd->typei = st->typei;
+            bd->typej = st->typej;
+        }
+        break;
+    default:
+        break;
+    }
+    st->n_fields = 0;
+    st->line_ok = false;
+}
+
+static inline bool is_space(char c)
+{
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r';
+}
+
+static void flush_carry(sax_state *st)
+{
+    if (st->carry_len == 0)
+        return;
+    on_token(st, st->carry, st->carry + st->carry_len);
+    st->carry_len = 0;
+}
+
+static uint64_t fnv1a(uint64_t h, const char *p, int len)
+{
+    for (int i = 0; i < len; i++)
+        h = (h ^ (unsigned char)p[i]) * FNV_PRIME;
+    return h;
+}
+
+static void on_characters(void *ctx, const xmlChar *ch, int len)
+{
+    sax_state *st = (sax_state *)ctx;
+    if (st->block == BLOCK_NONE)
+        return;
+
+    const char *p = (const char *)ch;
+    const char *end = p + len;
+    if (st->topo && (st->block == BLOCK_TYPE || st->block == BLOCK_BOND))
+    {
+        uint64_t *h = st->block == BLOCK_TYPE ? &st->type_hash : &st->bond_hash;
+        *h = fnv1a(*h, p, len);
+        if (st->skip_topology)
+            return;
+    }
+    while (p < end)
+    {
+        if (is_space(*p))
+        {
+            flush_carry(st);
+            if (*p == '\n')
+                end_line(st);
+            p++;
+            continue;
+        }
+
+        const char *begin = p;
+        if (st->carry_len == 0 && st->n_fields < 3 &&
+            (st->block == BLOCK_POSITION || st->block == BLOCK_VELOCITY || st->block == BLOCK_IMAGE))
+        {
+            // Coordinates and images are scanned as the token is found, in
+            // one pass; anything else is left to on_token()
+            const char *stop = st->block == BLOCK_IMAGE
+                                   ? scan_small_int(begin, end, &st->ids[st->n_fields])
+                                   : scan_decimal(begin, end, &st->values[st->n_fields]);
+            if (stop && stop < end && is_space(*stop))
+            {
+                st->line_ok = st->n_fields == 0 || st->line_ok;
+                st->n_fields++;
+                p = stop;
+                continue;
             }
         }
-        if (sscanf(line, "%s %s %d %d", type1, type2, &a1, &a2) == 4)
+        while (p < end && !is_space(*p))
+            p++;
+
+        if (p == end || st->carry_len > 0)
         {
-            bonds[idx].ai = a1;
-            bonds[idx].aj = a2;
-            strcpy(bonds[idx].typei, type1);
-            strcpy(bonds[idx].typej, type2);
-            idx++;
+            // The token may continue in the next chunk (or started in the
+            // previous one): assemble it in the carry buffer
+            int n = (int)(p - begin);
+            if (st->carry_len + n > MAX_TOKEN)
+                n = MAX_TOKEN - st->carry_len;
+            memcpy(st->carry + st->carry_len, begin, n);
+            st->carry_len += n;
+            if (p < end)
+                flush_carry(st);
+        }
+        else
+        {
+            on_token(st, begin, p);
         }
-        line = strtok(NULL, "\n");
     }
+}
+
+// Value of attribute `name` in a SAX2 attribute array (5 entries per
+// attribute: localname, prefix, URI, value, end), copied into buf
+static bool get_attribute(const xmlChar **attributes, int nb_attributes,
+                          const char *name, char *buf, int buf_size)
+{
+    for (int a = 0; a < nb_attributes; a++)
+    {
+        const xmlChar **attr = attributes + 5 * a;
+        if (strcmp((const char *)attr[0], name))
+            continue;
+        int len = (int)(attr[4] - attr[3]);
+        if (len >= buf_size)
+            len = buf_size - 1;
+        memcpy(buf, attr[3], len);
+        buf[len] = '\0';
+        return true;
+    }
+    return false;
+}
+
+static void read_box_attribute(const xmlChar **attributes, int nb_attributes,
+                               const char *name, float *value)
+{
+    char buf[64];
+    if (get_attribute(attributes, nb_attributes, name, buf, sizeof(buf)))
+        *value = atof(buf);
+}
+
+static void on_start_element(void *ctx, const xmlChar *localname,
+                             const xmlChar *prefix, const xmlChar *URI,
+                             int nb_namespaces, const xmlChar **namespaces,
+                             int nb_attributes, int nb_defaulted,
+                             const xmlChar **attributes)
+{
+    sax_state *st = (sax_state *)ctx;
+    const char *name = (const char *)localname;
+    char buf[64];
+
+    st->block = BLOCK_NONE;
+    st->carry_len = 0;
+    st->n_fields = 0;
+    st->line_ok = false;
+
+    if (!strcmp(name, "configuration"))
+    {
+        if (get_attribute(attributes, nb_attributes, "dimensions", buf, sizeof(buf)))
+            *st->dimensions = atoi(buf) == 2 ? 2 : 3;
+        return;
+    }
+
+    if (!strcmp(name, "box"))
+    {
+        read_box_attribute(attributes, nb_attributes, "lx", st->lx);
+        read_box_attribute(attributes, nb_attributes, "ly", st->ly);
+        read_box_attribute(attributes, nb_attributes, "lz", st->lz);
+        read_box_attribute(attributes, nb_attributes, "xy", st->xy);
+        read_box_attribute(attributes, nb_attributes, "xz", st->xz);
+        read_box_attribute(attributes, nb_attributes, "yz", st->yz);
+        return;
+    }
+
+    if (!strcmp(name, "position"))
+        st->block = BLOCK_POSITION;
+    else if (!strcmp(name, "velocity"))
+        st->block = BLOCK_VELOCITY;
+    else if (!strcmp(name, "image"))
+        st->block = st->read_images ? BLOCK_IMAGE : BLOCK_NONE;
+    else if (!strcmp(name, "type"))
+        st->block = BLOCK_TYPE;
+    else if (!strcmp(name, "bond"))
+    {
+        st->block = BLOCK_BOND;
+        st->has_bonds = true;
+    }
+    if (st->block == BLOCK_NONE)
+        return;
+
+    // Preallocate from num="..." so the arrays are filled without regrowth
+    if (get_attribute(attributes, nb_attributes, "num", buf, sizeof(buf)))
+    {
+        int num = atoi(buf);
+        if (st->block == BLOCK_BOND)
+            reserve_bonds(st, num);
+        else
+            reserve_particles(st, num);
+    }
+}
+
+static void on_end_element(void *ctx, const xmlChar *localname,
+                           const xmlChar *prefix, const xmlChar *URI)
+{
+    sax_state *st = (sax_state *)ctx;
+    if (st->block != BLOCK_NONE)
+    {
+        // Last line without a trailing newline
+        flush_carry(st);
+        end_line(st);
+    }
+    st->block = BLOCK_NONE;
+}
+
+static void free_state(sax_state *st)
+{
+    free(st->x); free(st->y); free(st->z);
+    free(st->vx); free(st->vy); free(st->vz);
+    free(st->ix); free(st->iy); free(st->iz);
+    free(st->types);
+    free(st->bonds);
+}
 
-    xmlFree(content);
+void init_parser()
+{
+    xmlInitParser();
+}
+
+void init_topology(topology *topo)
+{
+    topo->valid = topo->reused = false;
+    topo->n_particles = topo->n_bonds = 0;
+    topo->has_bonds = false;
+    topo->type_hash = topo->bond_hash = 0;
+    topo->type_names.clear();
+    topo->types = NULL;
+    topo->bonds = NULL;
 }
 
-void parse_type_block(xmlNode *node, char **types, int n_particles)
+void free_topology(topology *topo)
 {
-    xmlChar *content = xmlNodeGetContent(node);
-    char *line = strtok((char *)content, "\n");
-    int idx = 0;
+    free(topo->types);
+    free(topo->bonds);
+    init_topology(topo);
+}
 
-    while (line && idx < n_particles)
+// Keeps the parsed types and bonds in the cache
+static bool store_topology(topology *topo, const sax_state *st)
+{
+    free_topology(topo);
+    topo->types = (uint16_t *)malloc(sizeof(uint16_t) * (st->n_positions > 0 ? st->n_positions : 1));
+    topo->bonds = (bond *)malloc(sizeof(bond) * (st->n_bonds > 0 ? st->n_bonds : 1));
+    if (!topo->types || !topo->bonds)
     {
-        types[idx] = strdup(line);
-        idx++;
-        line = strtok(NULL, "\n");
+        free_topology(topo);
+        return false;
     }
+    memcpy(topo->types, st->types, sizeof(uint16_t) * st->n_positions);
+    memcpy(topo->bonds, st->bonds, sizeof(bond) * st->n_bonds);
+    topo->type_names = *st->type_names;
+    topo->n_particles = st->n_positions;
+    topo->n_bonds = st->n_bonds;
+    topo->has_bonds = st->has_bonds;
+    topo->type_hash = st->type_hash;
+    topo->bond_hash = st->bond_hash;
+    topo->valid = true;
+    return true;
+}
 
-    xmlFree(content);
+// Fills the types and bonds of st from the cache if it matches the file
+static bool load_topology(const topology *topo, sax_state *st)
+{
+    if (st->type_hash != topo->type_hash || st->bond_hash != topo->bond_hash ||
+        st->has_bonds != topo->has_bonds || st->n_positions != topo->n_particles)
+        return false;
+    reserve_particles(st, topo->n_particles);
+    reserve_bonds(st, topo->n_bonds);
+    if (st->out_of_memory)
+        return false;
+    memcpy(st->types, topo->types, sizeof(uint16_t) * topo->n_particles);
+    memcpy(st->bonds, topo->bonds, sizeof(bond) * topo->n_bonds);
+    *st->type_names = topo->type_names;
+    st->n_types = topo->n_particles;
+    st->n_bonds = topo->n_bonds;
+    return true;
 }
 
-// int parse_hoomd_xml(const char *filename,
-//                     float **x, float **y, float **z,
-//                     float **vx, float **vy, float **vz,
-//                     char ***types, int *n_particles)
 int parse_hoomd_xml(const char *filename,
                     float **x, float **y, float **z,
                     float **vx, float **vy, float **vz,
-                    char ***types, int *n_particles,
+                    int **ix, int **iy, int **iz,
+                    uint16_t **types, std::vector<std::string> *type_names,
+                    int *n_particles,
                     bond **bonds, int *n_bonds,
                     float *lx, float *ly, float *lz,
-                    float *xy, float *xz, float *yz)
+                    float *xy, float *xz, float *yz,
+                    int *dimensions,
+                    topology *topo, bool read_images,
+                    int *capacity, int *bond_capacity)
 {
-    xmlDoc *doc = xmlReadFile(filename, NULL, 0);
-    if (!doc)
+    FILE *fp = fopen(filename, "rb");
+    if (!fp)
     {
         fprintf(stderr, "Could not parse file %s\n", filename);
         return 1;
     }
 
-    xmlNode *root = xmlDocGetRootElement(doc);
-    xmlNode *conf = root->children;
-    xmlNode *position_node = NULL, *velocity_node = NULL, *type_node = NULL;
-    xmlNode *box_node = NULL, *bond_node = NULL;
-    
-    for (; conf; conf = conf->next)
+    sax_state st;
+    memset(&st, 0, sizeof(st));
+    if (capacity)
     {
-        if (conf->type == XML_ELEMENT_NODE &&
-            strcmp((char *)conf->name, "configuration") == 0)
-        {
-            for (xmlNode *child = conf->children; child; child = child->next)
-            {
-                if (child->type != XML_ELEMENT_NODE)
-                    continue;
-                if (!strcmp((char *)child->name, "position"))
-                    position_node = child;
-                else if (!strcmp((char *)child->name, "velocity"))
-                    velocity_node = child;
-                else if (!strcmp((char *)child->name, "type"))
-                    type_node = child;
-                else if (!strcmp((char *)child->name, "box"))
-                    box_node = child;
-                else if (!strcmp((char *)child->name, "bond"))
-                    bond_node = child;
-            }
-        }
+        st.x = *x; st.y = *y; st.z = *z;
+        st.vx = *vx; st.vy = *vy; st.vz = *vz;
+        st.ix = *ix; st.iy = *iy; st.iz = *iz;
+        st.types = *types;
+        st.capacity = *capacity;
+        st.bonds = *bonds;
+        st.bond_capacity = *bond_capacity;
     }
-
-    if (box_node)
-    {
-        xmlChar *val;
-
-        val = xmlGetProp(box_node, (const xmlChar *)"lx");
-        if (val)
+    // Hands the arrays to the caller, or frees them on failure unless the
+    // caller recycles its buffers
+    auto finish = [&](bool ok) {
+        if (!ok && !capacity)
         {
-            *lx = atof((const char *)val);
-            xmlFree(val);
+            free_state(&st);
+            return;
         }
-
-        val = xmlGetProp(box_node, (const xmlChar *)"ly");
-        if (val)
+        *x = st.x; *y = st.y; *z = st.z;
+        *vx = st.vx; *vy = st.vy; *vz = st.vz;
+        *ix = st.ix; *iy = st.iy; *iz = st.iz;
+        *types = st.types;
+        *bonds = st.bonds;
+        if (capacity)
         {
-            *ly = atof((const char *)val);
-            xmlFree(val);
+            *capacity = st.capacity;
+            *bond_capacity = st.bond_capacity;
         }
+    };
+    type_names->clear();
+    st.type_names = type_names;
+    st.last_type = -1;
+    st.lx = lx; st.ly = ly; st.lz = lz;
+    st.xy = xy; st.xz = xz; st.yz = yz;
+    *dimensions = 3;
+    st.dimensions = dimensions;
+    st.read_images = read_images;
+    st.topo = topo;
+    st.skip_topology = topo && topo->valid;
+    st.type_hash = st.bond_hash = FNV_OFFSET;
 
-        val = xmlGetProp(box_node, (const xmlChar *)"lz");
-        if (val)
-        {
-            *lz = atof((const char *)val);
-            xmlFree(val);
-        }
+    xmlSAXHandler handler;
+    memset(&handler, 0, sizeof(handler));
+    handler.initialized = XML_SAX2_MAGIC;
+    handler.startElementNs = on_start_element;
+    handler.endElementNs = on_end_element;
+    handler.characters = on_characters;
 
-        val = xmlGetProp(box_node, (const xmlChar *)"xy");
-        if (val)
-        {
-            *xy = atof((const char *)val);
-            xmlFree(val);
-        }
+    xmlParserCtxtPtr ctxt = xmlCreatePushParserCtxt(&handler, &st, NULL, 0, filename);
+    if (!ctxt)
+    {
+        fclose(fp);
+        fprintf(stderr, "Could not parse file %s\n", filename);
+        return 1;
+    }
 
-        val = xmlGetProp(box_node, (const xmlChar *)"xz");
-        if (val)
-        {
-            *xz = atof((const char *)val);
-            xmlFree(val);
-        }
+    char chunk[READ_CHUNK];
+    int err = 0;
+    size_t n_read;
+    while (!err && !st.out_of_memory && (n_read = fread(chunk, 1, sizeof(chunk), fp)) > 0)
+        err = xmlParseChunk(ctxt, chunk, (int)n_read, 0);
+    if (!err && !st.out_of_memory)
+        err = xmlParseChunk(ctxt, chunk, 0, 1);
+    if (!err && !ctxt->wellFormed)
+        err = 1;
+    xmlFreeParserCtxt(ctxt);
+    fclose(fp);
+
+    if (err || st.out_of_memory)
+    {
+        fprintf(stderr, "Could not parse file %s\n", filename);
+        finish(false);
+        return 1;
+    }
 
-        val = xmlGetProp(box_node, (const xmlChar *)"yz");
-        if (val)
+    if (st.skip_topology)
+    {
+        if (!load_topology(topo, &st))
         {
-            *yz = atof((const char *)val);
-            xmlFree(val);
+            // The topology changed: parse the file in full
+            finish(false);
+            topo->valid = false;
+            return parse_hoomd_xml(filename, x, y, z, vx, vy, vz, ix, iy, iz,
+                                   types, type_names, n_particles, bonds, n_bonds,
+                                   lx, ly, lz, xy, xz, yz, dimensions, topo, read_images,
+                                   capacity, bond_capacity);
         }
+        topo->reused = true;
     }
 
-    if (!position_node || !type_node)
+    if (st.n_positions == 0 || st.n_types < st.n_positions)
     {
         fprintf(stderr, "Missing required <position> or <type> blocks\n");
-        xmlFreeDoc(doc);
+        finish(false);
         return 2;
     }
 
-    xmlChar *raw = xmlNodeGetContent(position_node);
-    *n_particles = count_lines((char *)raw)-1;
-    xmlFree(raw);
-    
-    raw = xmlNodeGetContent(bond_node);
-    *n_bonds = count_lines((char *)raw)-1;
-    xmlFree(raw);
-
-    *x = (float*) malloc(sizeof(float) * (*n_particles));
-    *y = (float*) malloc(sizeof(float) * (*n_particles));
-    *z = (float*) malloc(sizeof(float) * (*n_particles));
-    *vx = (float*) malloc(sizeof(float) * (*n_particles));
-    *vy = (float*) malloc(sizeof(float) * (*n_particles));
-    *vz = (float*) malloc(sizeof(float) * (*n_particles));
-    *types = (char**) malloc(sizeof(char *) * (*n_particles));
-
-    parse_vector_components(position_node, *x, *y, *z, *n_particles);
-
-    if (velocity_node)
-        parse_vector_components(velocity_node, *vx, *vy, *vz, *n_particles);
-    else
-        memset(*vx, 0, sizeof(float) * (*n_particles)),
-            memset(*vy, 0, sizeof(float) * (*n_particles)),
-            memset(*vz, 0, sizeof(float) * (*n_particles));
+    if (!st.has_bonds)
+        fprintf(stderr, "Missing required <bond> block\n");
 
-    parse_type_block(type_node, *types, *n_particles);
+    if (topo && !st.skip_topology)
+    {
+        topo->reused = false;
+        store_topology(topo, &st);
+    }
 
-    if (!bond_node)
+    // Recycled buffers hold the previous snapshot past a short block
+    int n = st.n_positions;
+    if (st.n_velocities < n)
     {
-        *n_bonds = 0;
-        fprintf(stderr, "Missing required <bond> block\n");
-        xmlFreeDoc(doc);
-    } else {
-        *bonds = (bond*) malloc(sizeof(bond) * (*n_bonds));
-        parse_bond_components(bond_node, *bonds, *n_bonds);
+        size_t rest = sizeof(float) * (n - st.n_velocities);
+        memset(st.vx + st.n_velocities, 0, rest);
+        memset(st.vy + st.n_velocities, 0, rest);
+        memset(st.vz + st.n_velocities, 0, rest);
+    }
+    if (st.n_images < n)
+    {
+        size_t rest = sizeof(int) * (n - st.n_images);
+        memset(st.ix + st.n_images, 0, rest);
+        memset(st.iy + st.n_images, 0, rest);
+        memset(st.iz + st.n_images, 0, rest);
     }
 
-    xmlFreeDoc(doc);
-    xmlCleanupParser();
+    finish(true);
+    *n_particles = st.n_positions;
+    *n_bonds = st.n_bonds;
     return 0;
 }
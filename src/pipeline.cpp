@@ -0,0 +1,136 @@
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "pipeline.h"
+
+// Bounded FIFO of parsed snapshots between the reader and worker threads
+struct snapshot_queue {
+    size_t capacity;
+    std::deque<snapshot *> frames;
+    bool closed;
+    std::mutex mutex;
+    std::condition_variable not_full, not_empty;
+};
+
+// Blocks while the queue is full
+static void queue_push(snapshot_queue *q, snapshot *s)
+{
+    std::unique_lock<std::mutex> lock(q->mutex);
+    q->not_full.wait(lock, [q] { return q->frames.size() < q->capacity; });
+    q->frames.push_back(s);
+    q->not_empty.notify_one();
+}
+
+// Blocks while the queue is empty; NULL once it is closed and drained
+static snapshot *queue_pop(snapshot_queue *q)
+{
+    std::unique_lock<std::mutex> lock(q->mutex);
+    q->not_empty.wait(lock, [q] { return !q->frames.empty() || q->closed; });
+    if (q->frames.empty())
+        return NULL;
+    snapshot *s = q->frames.front();
+    q->frames.pop_front();
+    q->not_full.notify_one();
+    return s;
+}
+
+static void queue_close(snapshot_queue *q)
+{
+    std::lock_guard<std::mutex> lock(q->mutex);
+    q->closed = true;
+    q->not_empty.notify_all();
+}
+
+void run_pipeline(const run_options &opt, const pipeline_options &popt,
+                  const std::vector<snapshot_source> &sources,
+                  const std::function<void(frame_result &)> &emit)
+{
+    snapshot_queue queue;
+    queue.capacity = popt.queue_depth > 0 ? popt.queue_depth : 1;
+    queue.closed = false;
+
+    std::atomic<size_t> next_file(0);
+
+    // Processed snapshots are handed back to the readers with their
+    // buffers, so steady-state frames parse into memory already allocated
+    std::mutex pool_mutex;
+    std::vector<snapshot *> pool;
+    auto take_snapshot = [&]() {
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        if (pool.empty()) {
+            snapshot *s = new snapshot;
+            init_snapshot(s);
+            return s;
+        }
+        snapshot *s = pool.back();
+        pool.pop_back();
+        return s;
+    };
+    std::atomic<int> active_readers(popt.n_readers);
+
+    // Results are buffered until all earlier files have been emitted
+    std::mutex emit_mutex;
+    std::map<size_t, frame_result> pending;
+    size_t next_emit = 0;
+
+    auto reader = [&]() {
+        for (size_t i; (i = next_file++) < sources.size();) {
+            snapshot *s = take_snapshot();
+            read_snapshot(opt, i, sources[i], s);
+            queue_push(&queue, s);
+        }
+        if (--active_readers == 0)
+            queue_close(&queue);
+    };
+
+    auto worker = [&]() {
+#ifdef _OPENMP
+        omp_set_num_threads(popt.threads_per_worker);
+#endif
+        // Each worker keeps its own Verlet list and scratch arena over the
+        // frames it takes
+        verlet_list verlet;
+        init_verlet_list(&verlet, opt.verlet_skin);
+        frame_arena arena;
+        init_arena(&arena);
+        for (snapshot *s; (s = queue_pop(&queue)) != NULL;) {
+            frame_result r;
+            process_snapshot(opt, s, &r, opt.verlet_skin > 0 ? &verlet : NULL, &arena);
+            s->tindex = NULL;
+            {
+                std::lock_guard<std::mutex> lock(pool_mutex);
+                pool.push_back(s);
+            }
+
+            std::lock_guard<std::mutex> lock(emit_mutex);
+            pending.emplace(r.index, std::move(r));
+            for (auto it = pending.find(next_emit); it != pending.end();
+                 it = pending.find(next_emit)) {
+                emit(it->second);
+                pending.erase(it);
+                next_emit++;
+            }
+        }
+        free_verlet_list(&verlet);
+        free_arena(&arena);
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < popt.n_readers; i++)
+        threads.emplace_back(reader);
+    for (int i = 0; i < popt.n_workers; i++)
+        threads.emplace_back(worker);
+    for (auto &t : threads)
+        t.join();
+    for (snapshot *s : pool) {
+        free_snapshot(s);
+        delete s;
+    }
+}
@@ -0,0 +1,398 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <limits.h>
+#include <algorithm>
+#include "slab_clustering.h"
+
+// Rows of the frame streamed from the file at a time
+static const int BLOCK_ROWS = 1 << 16;
+
+// Member of a boundary cluster within the cut-off of a slab face
+struct face_particle {
+    float x, y, z;
+    int selection;
+    long long label;            // provisional label of its cluster
+};
+
+// Union-find over the provisional labels; a set is rooted at its
+// smallest label
+static long long find_label(std::vector<long long> &parent, long long a)
+{
+    while (parent[a] != a)
+    {
+        parent[a] = parent[parent[a]];
+        a = parent[a];
+    }
+    return a;
+}
+
+static void union_labels(std::vector<long long> &parent, long long a, long long b)
+{
+    a = find_label(parent, a);
+    b = find_label(parent, b);
+    if (a != b)
+        parent[std::max(a, b)] = std::min(a, b);
+}
+
+// Searches the pairs between the boundary layers on both sides of a face
+// (below: the upper layer of one slab, above: the lower layer of the next)
+// in a box of lengths fbox. Every pair across the face is a link and
+// merges the labels of its two clusters. Across the periodic wrap (box
+// length L along the axis) only the pairs whose nearest image is through
+// the wrap count; with two slabs the others were found at the inner face.
+static void merge_face(const std::vector<face_particle> &below, const std::vector<face_particle> &above,
+                       const float *fbox, bool across_wrap, int axis, float L,
+                       const slab_options &opt, int dimensions, int n_selections,
+                       const char *const *out_names, std::vector<long long> &parent,
+                       long long *n_links, phase_timings *timings)
+{
+    if (below.empty() || above.empty())
+        return;
+
+    int n = below.size() + above.size();
+    std::vector<int> sel_start(n_selections + 1, 0);
+    for (const auto &p : below)
+        sel_start[p.selection + 1]++;
+    for (const auto &p : above)
+        sel_start[p.selection + 1]++;
+    for (int g = 0; g < n_selections; g++)
+        sel_start[g + 1] += sel_start[g];
+
+    std::vector<float> x(n), y(n), z(n);
+    std::vector<const face_particle *> source(n);
+    std::vector<char> side(n);
+    std::vector<int> fill(sel_start.begin(), sel_start.end() - 1);
+    for (int s = 0; s < 2; s++)
+        for (const auto &p : s ? above : below)
+        {
+            int k = fill[p.selection]++;
+            x[k] = p.x; y[k] = p.y; z[k] = p.z;
+            source[k] = &p;
+            side[k] = s;
+        }
+
+    std::vector<selection_pair> pairs;
+    find_selection_pairs(x.data(), y.data(), z.data(), opt.cutoff, n_selections, sel_start.data(),
+                         fbox[0], fbox[1], fbox[2], out_names, opt.use_pbc, dimensions, opt.engine,
+                         &pairs, timings);
+
+    const float *r[3] = {x.data(), y.data(), z.data()};
+    for (const auto &pr : pairs)
+    {
+        if (side[pr.i] == side[pr.j])
+            continue;
+        if (across_wrap && fabsf(r[axis][pr.i] - r[axis][pr.j]) <= 0.5f * L)
+            continue;
+        n_links[pr.selection]++;
+        union_labels(parent, source[pr.i]->label, source[pr.j]->label);
+    }
+}
+
+int cluster_gsd_slabs(const gsd_file *g, long long frame, const slab_options &opt,
+                      const std::vector<std::string> &types, const char *const *out_names,
+                      const std::string &scratch_name, std::vector<cluster_stats> *stats,
+                      slab_report *report, phase_timings *timings, frame_arena *arena)
+{
+    gsd_particle_stream ps;
+    std::vector<std::string> type_names;
+    float box[3];
+    int dimensions;
+    if (open_gsd_particles(g, frame, &ps, &type_names, &box[0], &box[1], &box[2], &dimensions) != 0)
+        return 2;
+    if (ps.n_particles > INT_MAX)
+    {
+        fprintf(stderr, "Frame of %lld particles: cluster files hold 32-bit ids\n", ps.n_particles);
+        return 2;
+    }
+
+    // Selection of every type id (the first one naming it)
+    int n_selections = types.size();
+    std::vector<int> selection_of_type(type_names.size(), -1);
+    for (int s = n_selections - 1; s >= 0; s--)
+        for (size_t t = 0; t < type_names.size(); t++)
+            if (type_names[t] == types[s])
+                selection_of_type[t] = s;
+
+    // Slabs along the longest axis, at least one cut-off thick so that
+    // only neighbouring slabs can be linked. The slabs are clustered in a
+    // box padded along the axis to T + 2 cut-offs: no pair within the
+    // cut-off wraps around it, and the positions stay those of the frame,
+    // so every distance rounds as in the in-memory search.
+    float cut = opt.cutoff;
+    int axis = 0;
+    for (int a = 1; a < dimensions; a++)
+        if (box[a] > box[axis])
+            axis = a;
+    float L = box[axis];
+    int n_slabs = std::max(1, opt.n_slabs);
+    if (!(L > 0))
+        n_slabs = 1;
+    else if (cut > 0)
+        n_slabs = std::min(n_slabs, std::max(1, (int)floorf(L / cut)));
+    float T = L / n_slabs;
+    bool wrap = opt.use_pbc && n_slabs > 1;
+    float slab_box[3] = {box[0], box[1], box[2]};
+    float face_box[3] = {box[0], box[1], box[2]};
+    if (n_slabs > 1)
+    {
+        slab_box[axis] = T + 2 * cut;
+        face_box[axis] = 4 * cut;
+    }
+    // Layers a little thicker than the cut-off, so no pair across a face
+    // is lost to the rounding of the slab bounds
+    float layer = 1.001f * cut;
+
+    report->n_slabs = n_slabs;
+    report->axis = axis;
+    report->n_particles = ps.n_particles;
+    report->max_slab = report->n_boundary = 0;
+    report->n_selected.assign(n_selections, 0);
+    report->n_links.assign(n_selections, 0);
+    report->n_clusters.assign(n_selections, 0);
+    std::vector<long long> &n_links = report->n_links, &n_clusters = report->n_clusters;
+
+    std::vector<cluster_stream> writers(n_selections);
+    std::vector<cluster_stats> selection_stats(n_selections);
+    for (int s = 0; s < n_selections; s++)
+        if (out_names[s])
+            open_cluster_stream(&writers[s], out_names[s], opt.format, &selection_stats[s]);
+
+    // Members of the boundary clusters, by provisional label
+    FILE *scratch = fopen(scratch_name.c_str(), "w+b");
+    if (!scratch) {
+        printf("ERROR: enable to create file %s\n", scratch_name.c_str());
+        exit(2);
+    }
+    std::vector<long long> parent, label_offset;
+    std::vector<int> label_size, label_selection;
+    long long scratch_ids = 0;
+
+    std::vector<float> bx(BLOCK_ROWS), by(BLOCK_ROWS), bz(BLOCK_ROWS);
+    std::vector<uint16_t> bt(BLOCK_ROWS);
+    std::vector<float> px, py, pz;
+    std::vector<int> ptag, psel, ids;
+    std::vector<face_particle> lower, upper, prev_upper, first_lower;
+
+    for (int k = 0; k < n_slabs; k++)
+    {
+        // Nothing of the previous slab is kept in the arena
+        if (arena)
+            arena_reset(arena);
+        float lo = -0.5f * L + k * T, hi = lo + T;
+        bool has_lower = wrap || k > 0, has_upper = wrap || k < n_slabs - 1;
+
+        // The particles of the slab, in frame order
+        px.clear(); py.clear(); pz.clear();
+        ptag.clear(); psel.clear();
+        {
+            scoped_phase timer(timings, PHASE_PARSE);
+            for (long long first = 0; first < ps.n_particles; first += BLOCK_ROWS)
+            {
+                int count = (int)std::min<long long>(BLOCK_ROWS, ps.n_particles - first);
+                read_gsd_particles(&ps, first, count, bx.data(), by.data(), bz.data(), bt.data());
+                for (int i = 0; i < count; i++)
+                {
+                    int s = selection_of_type[bt[i]];
+                    if (s < 0 || !out_names[s])
+                        continue;
+                    float r[3] = {bx[i], by[i], bz[i]};
+                    if (n_slabs > 1)
+                    {
+                        if (opt.use_pbc)
+                            r[axis] -= L * floorf(r[axis] / L + 0.5f);
+                        int slab = (int)floorf((r[axis] + 0.5f * L) / T);
+                        if (std::min(std::max(slab, 0), n_slabs - 1) != k)
+                            continue;
+                    }
+                    px.push_back(r[0]); py.push_back(r[1]); pz.push_back(r[2]);
+                    ptag.push_back((int)(first + i));
+                    psel.push_back(s);
+                }
+            }
+            if (timings)
+                timings->counts[COUNT_BYTES_PARSED] += ps.n_particles * (3 * sizeof(float) + sizeof(uint32_t));
+        }
+        int n = px.size();
+        report->max_slab = std::max(report->max_slab, (long long)n);
+
+        // Counting sort by selection, with the faces every particle is near
+        // (bit 0: lower, bit 1: upper)
+        double t0 = wall_time();
+        int *sel_start = arena_array<int>(arena, n_selections + 1);
+        memset(sel_start, 0, sizeof(int) * (n_selections + 1));
+        for (int i = 0; i < n; i++)
+            sel_start[psel[i] + 1]++;
+        for (int s = 0; s < n_selections; s++)
+            sel_start[s + 1] += sel_start[s];
+        float *x = arena_array<float>(arena, n);
+        float *y = arena_array<float>(arena, n);
+        float *z = arena_array<float>(arena, n);
+        int *tag = arena_array<int>(arena, n);
+        char *face = arena_array<char>(arena, n);
+        int *fill = arena_array<int>(arena, n_selections);
+        memcpy(fill, sel_start, sizeof(int) * n_selections);
+        const std::vector<float> *pr[3] = {&px, &py, &pz};
+        for (int i = 0; i < n; i++)
+        {
+            int j = fill[psel[i]]++;
+            x[j] = px[i]; y[j] = py[i]; z[j] = pz[i];
+            tag[j] = ptag[i];
+            float u = (*pr[axis])[i];
+            face[j] = (has_lower && u < lo + layer ? 1 : 0) | (has_upper && u >= hi - layer ? 2 : 0);
+        }
+        for (int s = 0; s < n_selections; s++)
+            report->n_selected[s] += sel_start[s + 1] - sel_start[s];
+        if (timings)
+            timings->seconds[PHASE_PARTITION] += wall_time() - t0;
+
+        concurrent_union_find uf;
+        int *slab_links = arena_array<int>(arena, n_selections);
+        link_selections(x, y, z, cut, n_selections, sel_start, slab_box[0], slab_box[1], slab_box[2],
+                        out_names, opt.use_pbc, dimensions, opt.engine, &uf, slab_links, timings, arena);
+        for (int s = 0; s < n_selections; s++)
+            n_links[s] += slab_links[s];
+
+        // Interior clusters are final and written now; the others get a
+        // provisional label and wait in the scratch file
+        for (int s = 0; s < n_selections; s++)
+        {
+            int first = sel_start[s], count = sel_start[s + 1] - first;
+            if (!out_names[s] || count == 0)
+                continue;
+            int *labels = arena_array<int>(arena, count);
+            int *offsets = arena_array<int>(arena, count + 1);
+            int *members = arena_array<int>(arena, count);
+            int n_local;
+            {
+                scoped_phase timer(timings, PHASE_CLUSTERS);
+                n_local = cluster_labels(&uf, first, count, labels, offsets, members, arena);
+            }
+
+            scoped_phase timer(timings, PHASE_OUTPUT);
+            for (int c = 0; c < n_local; c++)
+            {
+                int size = offsets[c + 1] - offsets[c];
+                const int *m = members + offsets[c];
+                bool boundary = false;
+                ids.resize(size);
+                for (int i = 0; i < size; i++)
+                {
+                    ids[i] = tag[first + m[i]];
+                    boundary |= face[first + m[i]] != 0;
+                }
+                if (!boundary)
+                {
+                    begin_stream_cluster(&writers[s], size);
+                    write_stream_ids(&writers[s], ids.data(), size);
+                    n_clusters[s]++;
+                    continue;
+                }
+
+                long long label = parent.size();
+                parent.push_back(label);
+                label_offset.push_back(scratch_ids);
+                label_size.push_back(size);
+                label_selection.push_back(s);
+                fwrite(ids.data(), sizeof(int), size, scratch);
+                scratch_ids += size;
+                for (int i = 0; i < size; i++)
+                {
+                    int p = first + m[i];
+                    face_particle fp = {x[p], y[p], z[p], s, label};
+                    if (face[p] & 1)
+                        lower.push_back(fp);
+                    if (face[p] & 2)
+                        upper.push_back(fp);
+                }
+            }
+            arena_release(arena, labels);
+            arena_release(arena, offsets);
+            arena_release(arena, members);
+        }
+        cuf_free(&uf);
+        arena_release(arena, slab_links);
+        arena_release(arena, sel_start);
+        arena_release(arena, x); arena_release(arena, y); arena_release(arena, z);
+        arena_release(arena, tag);
+        arena_release(arena, face);
+        arena_release(arena, fill);
+
+        if (k > 0)
+            merge_face(prev_upper, lower, face_box, false, axis, L, opt, dimensions,
+                       n_selections, out_names, parent, n_links.data(), timings);
+        if (k == 0)
+            first_lower.swap(lower);
+        prev_upper.swap(upper);
+        lower.clear();
+        upper.clear();
+    }
+    if (wrap)
+        merge_face(prev_upper, first_lower, box, true, axis, L, opt, dimensions,
+                   n_selections, out_names, parent, n_links.data(), timings);
+
+    // The boundary clusters: the provisional labels grouped by root, each
+    // group written as one cluster
+    {
+        scoped_phase timer(timings, PHASE_OUTPUT);
+        long long n_labels = parent.size();
+        report->n_boundary = n_labels;
+        std::vector<long long> group_start(n_labels + 1, 0), grouped(n_labels);
+        for (long long l = 0; l < n_labels; l++)
+            group_start[find_label(parent, l) + 1]++;
+        for (long long l = 0; l < n_labels; l++)
+            group_start[l + 1] += group_start[l];
+        std::vector<long long> group_fill(group_start.begin(), group_start.end() - 1);
+        for (long long l = 0; l < n_labels; l++)
+            grouped[group_fill[find_label(parent, l)]++] = l;
+
+        ids.resize(BLOCK_ROWS);
+        for (long long root = 0; root < n_labels; root++)
+        {
+            if (group_start[root] == group_start[root + 1])
+                continue;
+            int s = label_selection[root];
+            long long size = 0;
+            for (long long k = group_start[root]; k < group_start[root + 1]; k++)
+                size += label_size[grouped[k]];
+            begin_stream_cluster(&writers[s], size);
+            n_clusters[s]++;
+            for (long long k = group_start[root]; k < group_start[root + 1]; k++)
+            {
+                long long l = grouped[k];
+                fseeko(scratch, (off_t)label_offset[l] * sizeof(int), SEEK_SET);
+                for (int done = 0; done < label_size[l];)
+                {
+                    int count = std::min(BLOCK_ROWS, label_size[l] - done);
+                    if (fread(ids.data(), sizeof(int), count, scratch) != (size_t)count)
+                    {
+                        fprintf(stderr, "Cannot read back %s\n", scratch_name.c_str());
+                        exit(2);
+                    }
+                    write_stream_ids(&writers[s], ids.data(), count);
+                    done += count;
+                }
+            }
+        }
+        fclose(scratch);
+        remove(scratch_name.c_str());
+
+        for (int s = 0; s < n_selections; s++)
+        {
+            if (!out_names[s])
+                continue;
+            close_cluster_stream(&writers[s], n_links[s], 1);
+            if (opt.format == CLUSTER_STATS_ONLY)
+                stats->push_back(selection_stats[s]);
+        }
+    }
+
+    if (timings)
+        for (int s = 0; s < n_selections; s++)
+        {
+            timings->counts[COUNT_LINKS] += n_links[s];
+            timings->counts[COUNT_CLUSTERS] += n_clusters[s];
+        }
+    return 0;
+}
@@ -0,0 +1,186 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <chrono>
+#include "timing.h"
+
+static const char *phase_names[N_PHASES] = {
+    "parse", "partition", "pairs", "clusters", "output"
+};
+
+static const char *counter_names[N_COUNTERS] = {
+    "bytes_parsed", "pairs_tested", "links", "unions", "label_iterations", "clusters"
+};
+
+double wall_time()
+{
+    using clock = std::chrono::steady_clock;
+    return std::chrono::duration<double>(clock::now().time_since_epoch()).count();
+}
+
+scoped_phase::scoped_phase(phase_timings *t, phase p) : t(t), p(p), t0(t ? wall_time() : 0.0)
+{
+}
+
+scoped_phase::~scoped_phase()
+{
+    if (t)
+        t->seconds[p] += wall_time() - t0;
+}
+
+void reset_timings(phase_timings *t)
+{
+    for (int p = 0; p < N_PHASES; p++)
+        t->seconds[p] = 0.0;
+    for (int c = 0; c < N_COUNTERS; c++)
+        t->counts[c] = 0;
+    t->n_threads = 0;
+    for (int k = 0; k < MAX_METRIC_THREADS; k++)
+    {
+        t->thread_pairs[k] = 0;
+        t->thread_seconds[k] = 0.0;
+    }
+}
+
+void add_timings(phase_timings *t, const phase_timings *other)
+{
+    for (int p = 0; p < N_PHASES; p++)
+        t->seconds[p] += other->seconds[p];
+    for (int c = 0; c < N_COUNTERS; c++)
+        t->counts[c] += other->counts[c];
+    if (other->n_threads > t->n_threads)
+        t->n_threads = other->n_threads;
+    for (int k = 0; k < other->n_threads; k++)
+    {
+        t->thread_pairs[k] += other->thread_pairs[k];
+        t->thread_seconds[k] += other->thread_seconds[k];
+    }
+}
+
+void add_thread_work(phase_timings *t, int thread, long long pairs, double seconds)
+{
+    if (!t)
+        return;
+    int k = thread < MAX_METRIC_THREADS ? thread : MAX_METRIC_THREADS - 1;
+#pragma omp critical(thread_work)
+    {
+        if (k + 1 > t->n_threads)
+            t->n_threads = k + 1;
+        t->thread_pairs[k] += pairs;
+        t->thread_seconds[k] += seconds;
+        t->counts[COUNT_PAIRS_TESTED] += pairs;
+    }
+}
+
+double thread_imbalance(const phase_timings *t)
+{
+    double sum = 0.0, max = 0.0;
+    for (int k = 0; k < t->n_threads; k++)
+    {
+        sum += t->thread_seconds[k];
+        if (t->thread_seconds[k] > max)
+            max = t->thread_seconds[k];
+    }
+    return sum > 0.0 ? max * t->n_threads / sum : 0.0;
+}
+
+std::string format_timings(const char *label, const phase_timings *t)
+{
+    char buf[64];
+    double total = 0.0;
+    std::string line = label;
+    for (int p = 0; p < N_PHASES; p++)
+    {
+        snprintf(buf, sizeof(buf), " %s %.4f s", phase_names[p], t->seconds[p]);
+        line += buf;
+        total += t->seconds[p];
+    }
+    snprintf(buf, sizeof(buf), " total %.4f s\n", total);
+    return line + buf;
+}
+
+void print_timings(FILE *f, const char *label, const phase_timings *t)
+{
+    fputs(format_timings(label, t).c_str(), f);
+}
+
+std::string format_metrics_json(const phase_timings *t)
+{
+    char buf[96];
+    double total = 0.0;
+    std::string json = "\"seconds\": {";
+    for (int p = 0; p < N_PHASES; p++)
+    {
+        snprintf(buf, sizeof(buf), "\"%s\": %.6f, ", phase_names[p], t->seconds[p]);
+        json += buf;
+        total += t->seconds[p];
+    }
+    snprintf(buf, sizeof(buf), "\"total\": %.6f}, \"counts\": {", total);
+    json += buf;
+    for (int c = 0; c < N_COUNTERS; c++)
+    {
+        snprintf(buf, sizeof(buf), "%s\"%s\": %lld", c ? ", " : "", counter_names[c], t->counts[c]);
+        json += buf;
+    }
+    json += "}, \"thread_pairs\": [";
+    for (int k = 0; k < t->n_threads; k++)
+    {
+        snprintf(buf, sizeof(buf), "%s%lld", k ? ", " : "", t->thread_pairs[k]);
+        json += buf;
+    }
+    json += "], \"thread_seconds\": [";
+    for (int k = 0; k < t->n_threads; k++)
+    {
+        snprintf(buf, sizeof(buf), "%s%.6f", k ? ", " : "", t->thread_seconds[k]);
+        json += buf;
+    }
+    snprintf(buf, sizeof(buf), "], \"imbalance\": %.3f", thread_imbalance(t));
+    return json + buf;
+}
+
+// "VmRSS:" or "VmHWM:" of /proc/self/status in kB, -1 if not there
+static long proc_status_kb(const char *field)
+{
+    FILE *f = fopen("/proc/self/status", "r");
+    if (!f)
+        return -1;
+    char line[256];
+    long kb = -1;
+    size_t len = strlen(field);
+    while (fgets(line, sizeof(line), f))
+        if (!strncmp(line, field, len))
+        {
+            kb = strtol(line + len, NULL, 10);
+            break;
+        }
+    fclose(f);
+    return kb;
+}
+
+long peak_rss_kb()
+{
+    // The high-water mark of the address space, which reset_peak_rss()
+    // restarts; getrusage() elsewhere
+    long kb = proc_status_kb("VmHWM:");
+    if (kb >= 0)
+        return kb;
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+    return usage.ru_maxrss;     // kB on Linux
+}
+
+long current_rss_kb()
+{
+    return proc_status_kb("VmRSS:");
+}
+
+bool reset_peak_rss()
+{
+    FILE *f = fopen("/proc/self/clear_refs", "w");
+    if (!f)
+        return false;
+    bool ok = fputs("5", f) >= 0;
+    return fclose(f) == 0 && ok;
+}
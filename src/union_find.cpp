@@ -0,0 +1,110 @@
+#include <stdlib.h>
+#include <new>
+#include "union_find.h"
+
+void uf_init(union_find *uf, int n, frame_arena *arena)
+{
+    uf->n = n;
+    uf->arena = arena;
+    uf->parent = arena_array<int>(arena, n);
+    uf->rank = arena_array<int>(arena, n);
+    for (int i = 0; i < n; i++)
+    {
+        uf->parent[i] = i;
+        uf->rank[i] = 0;
+    }
+}
+
+int uf_find(union_find *uf, int i)
+{
+    int root = i;
+    while (uf->parent[root] != root)
+        root = uf->parent[root];
+    while (uf->parent[i] != root)
+    {
+        int next = uf->parent[i];
+        uf->parent[i] = root;
+        i = next;
+    }
+    return root;
+}
+
+bool uf_union(union_find *uf, int i, int j)
+{
+    int ri = uf_find(uf, i);
+    int rj = uf_find(uf, j);
+    if (ri == rj)
+        return false;
+    if (uf->rank[ri] < uf->rank[rj])
+    {
+        int t = ri;
+        ri = rj;
+        rj = t;
+    }
+    uf->parent[rj] = ri;
+    if (uf->rank[ri] == uf->rank[rj])
+        uf->rank[ri]++;
+    return true;
+}
+
+void uf_free(union_find *uf)
+{
+    arena_release(uf->arena, uf->parent);
+    arena_release(uf->arena, uf->rank);
+    uf->parent = NULL;
+    uf->rank = NULL;
+}
+
+void cuf_init(concurrent_union_find *uf, int n, frame_arena *arena)
+{
+    uf->n = n;
+    uf->arena = arena;
+    uf->parent = arena_array<std::atomic<int>>(arena, n);
+    for (int i = 0; i < n; i++)
+        new (&uf->parent[i]) std::atomic<int>(i);
+}
+
+int cuf_find(concurrent_union_find *uf, int i)
+{
+    while (true)
+    {
+        int p = uf->parent[i].load(std::memory_order_acquire);
+        if (p == i)
+            return i;
+        int gp = uf->parent[p].load(std::memory_order_acquire);
+        // Path halving; losing the race only means less compression
+        if (p != gp)
+            uf->parent[i].compare_exchange_weak(p, gp, std::memory_order_acq_rel,
+                                                std::memory_order_relaxed);
+        i = gp;
+    }
+}
+
+bool cuf_union(concurrent_union_find *uf, int i, int j)
+{
+    while (true)
+    {
+        i = cuf_find(uf, i);
+        j = cuf_find(uf, j);
+        if (i == j)
+            return false;
+        if (i < j)
+        {
+            int t = i;
+            i = j;
+            j = t;
+        }
+        // i may have been linked by another thread since the find: retry
+        int expected = i;
+        if (uf->parent[i].compare_exchange_strong(expected, j, std::memory_order_acq_rel,
+                                                  std::memory_order_relaxed))
+            return true;
+    }
+}
+
+void cuf_free(concurrent_union_find *uf)
+{
+    // std::atomic<int> is trivially destructible
+    arena_release(uf->arena, uf->parent);
+    uf->parent = NULL;
+}
@@ -0,0 +1,192 @@
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "pair_kernel.h"
+#include "union_find.h"
+#include "verlet_list.h"
+
+void init_verlet_list(verlet_list *vl, float skin)
+{
+    memset(vl, 0, sizeof(*vl));
+    vl->skin = skin;
+}
+
+static void release_build(verlet_list *vl)
+{
+    free(vl->sel_start);
+    free(vl->aindex);
+    free(vl->x0); free(vl->y0); free(vl->z0);
+    free(vl->pair_start);
+    free(vl->pair_j);
+    vl->sel_start = vl->aindex = NULL;
+    vl->x0 = vl->y0 = vl->z0 = NULL;
+    vl->pair_start = vl->pair_j = NULL;
+    vl->built = false;
+}
+
+void free_verlet_list(verlet_list *vl)
+{
+    release_build(vl);
+}
+
+// Whether the list of the last build still covers every pair of this frame
+static bool list_is_valid(const verlet_list *vl,
+                          const float *ux, const float *uy, const float *uz,
+                          float dist_cluster, int n_selections, const int *sel_start,
+                          float Lx, float Ly, float Lz, const int *aindex)
+{
+    if (!vl->built || vl->cutoff != dist_cluster || vl->n_selections != n_selections ||
+        vl->L[0] != Lx || vl->L[1] != Ly || vl->L[2] != Lz)
+        return false;
+    if (memcmp(vl->sel_start, sel_start, sizeof(int) * (n_selections + 1)) ||
+        memcmp(vl->aindex, aindex, sizeof(int) * vl->n_particles))
+        return false;
+
+    float max_disp2 = 0;
+#pragma omp parallel for schedule(static) reduction(max : max_disp2)
+    for (int e = 0; e < vl->n_particles; e++)
+    {
+        float dx = ux[e] - vl->x0[e], dy = uy[e] - vl->y0[e], dz = uz[e] - vl->z0[e];
+        float disp2 = dx * dx + dy * dy + dz * dz;
+        if (disp2 > max_disp2)
+            max_disp2 = disp2;
+    }
+    float half_skin = 0.5f * vl->skin;
+    return max_disp2 <= half_skin * half_skin;
+}
+
+static void build_list(verlet_list *vl,
+                       const float *rx, const float *ry, const float *rz,
+                       const float *ux, const float *uy, const float *uz,
+                       float dist_cluster, int n_selections, const int *sel_start,
+                       float Lx, float Ly, float Lz,
+                       const int *aindex, const char *const *out_names,
+                       bool use_pbc, int dimensions, neighbor_engine engine,
+                       phase_timings *timings)
+{
+    release_build(vl);
+
+    int n = sel_start[n_selections];
+    std::vector<selection_pair> pairs;
+    find_selection_pairs(rx, ry, rz, dist_cluster + vl->skin, n_selections, sel_start,
+                         Lx, Ly, Lz, out_names, use_pbc, dimensions, engine, &pairs, timings);
+
+    // Every pair is kept once, under its lower entry
+    vl->pair_start = (int *)calloc(n + 1, sizeof(int));
+    vl->pair_j = (int *)malloc(sizeof(int) * (pairs.size() > 0 ? pairs.size() : 1));
+    for (const auto &p : pairs)
+        vl->pair_start[(p.i < p.j ? p.i : p.j) + 1]++;
+    for (int e = 0; e < n; e++)
+        vl->pair_start[e + 1] += vl->pair_start[e];
+    std::vector<int> fill(vl->pair_start, vl->pair_start + n);
+    for (const auto &p : pairs)
+    {
+        int lo = p.i < p.j ? p.i : p.j, hi = p.i < p.j ? p.j : p.i;
+        vl->pair_j[fill[lo]++] = hi;
+    }
+
+    vl->cutoff = dist_cluster;
+    vl->L[0] = Lx; vl->L[1] = Ly; vl->L[2] = Lz;
+    vl->n_selections = n_selections;
+    vl->n_particles = n;
+    vl->sel_start = (int *)malloc(sizeof(int) * (n_selections + 1));
+    memcpy(vl->sel_start, sel_start, sizeof(int) * (n_selections + 1));
+    vl->aindex = (int *)malloc(sizeof(int) * (n > 0 ? n : 1));
+    memcpy(vl->aindex, aindex, sizeof(int) * n);
+    vl->x0 = (float *)malloc(sizeof(float) * (n > 0 ? n : 1));
+    vl->y0 = (float *)malloc(sizeof(float) * (n > 0 ? n : 1));
+    vl->z0 = (float *)malloc(sizeof(float) * (n > 0 ? n : 1));
+    memcpy(vl->x0, ux, sizeof(float) * n);
+    memcpy(vl->y0, uy, sizeof(float) * n);
+    memcpy(vl->z0, uz, sizeof(float) * n);
+    vl->built = true;
+    vl->n_builds++;
+}
+
+bool verlet_selections(verlet_list *vl,
+                       const float *rx, const float *ry, const float *rz,
+                       const int *ix, const int *iy, const int *iz,
+                       float dist_cluster, int n_selections, const int *sel_start,
+                       float Lx, float Ly, float Lz,
+                       int *aindex, const char *const *out_names,
+                       bool use_pbc, int dimensions, neighbor_engine engine,
+                       phase_timings *timings, frame_arena *arena)
+{
+    double t0 = wall_time();
+    int n = sel_start[n_selections];
+    vl->n_frames++;
+
+    // Unwrapped positions of the entries
+    float *ux = arena_array<float>(arena, n);
+    float *uy = arena_array<float>(arena, n);
+    float *uz = arena_array<float>(arena, n);
+    for (int e = 0; e < n; e++)
+    {
+        int p = aindex[e];
+        ux[e] = rx[e] + ix[p] * Lx;
+        uy[e] = ry[e] + iy[p] * Ly;
+        uz[e] = rz[e] + iz[p] * Lz;
+    }
+
+    bool rebuild = !list_is_valid(vl, ux, uy, uz, dist_cluster,
+                                  n_selections, sel_start, Lx, Ly, Lz, aindex);
+    if (rebuild)
+        build_list(vl, rx, ry, rz, ux, uy, uz, dist_cluster,
+                   n_selections, sel_start, Lx, Ly, Lz, aindex, out_names,
+                   use_pbc, dimensions, engine, timings);
+    arena_release(arena, ux);
+    arena_release(arena, uy);
+    arena_release(arena, uz);
+
+    int *selection_of = arena_array<int>(arena, n);
+    for (int g = 0; g < n_selections; g++)
+        for (int e = sel_start[g]; e < sel_start[g + 1]; e++)
+            selection_of[e] = g;
+
+    pair_box box;
+    init_pair_box(&box, Lx, Ly, Lz, dist_cluster);
+
+    concurrent_union_find uf;
+    cuf_init(&uf, n, arena);
+    int *n_links = arena_array<int>(arena, n_selections);
+    memset(n_links, 0, sizeof(int) * (n_selections > 0 ? n_selections : 1));
+
+    // Filter the cached pairs by the cut-off
+#pragma omp parallel
+    {
+        double t_thread = wall_time();
+        long long tested = 0;
+#pragma omp for schedule(static, 256) reduction(+ : n_links[:n_selections]) nowait
+        for (int e = 0; e < n; e++)
+        {
+            int g = selection_of[e];
+            tested += vl->pair_start[e + 1] - vl->pair_start[e];
+            for (int k = vl->pair_start[e]; k < vl->pair_start[e + 1]; k++)
+            {
+                int j = vl->pair_j[k];
+                if (pair_kernel_dist2(rx[e], ry[e], rz[e], rx, ry, rz, j, &box, use_pbc, dimensions) < box.cut2)
+                {
+                    cuf_union(&uf, e, j);
+                    n_links[g]++;
+                }
+            }
+        }
+        int thread = 0;
+#ifdef _OPENMP
+        thread = omp_get_thread_num();
+#endif
+        add_thread_work(timings, thread, tested, wall_time() - t_thread);
+    }
+
+    if (timings)
+        timings->seconds[PHASE_PAIRS] += wall_time() - t0;
+
+    arena_release(arena, selection_of);
+    write_selection_clusters(&uf, n_links, n_selections, sel_start, aindex, out_names, timings, arena);
+    cuf_free(&uf);
+    arena_release(arena, n_links);
+    return rebuild;
+}
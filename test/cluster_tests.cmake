@@ -0,0 +1,154 @@
+# Regression tests on test/snapshot.0326000000.xml, run by ctest as
+#   cmake -DCASE=<case> -DSNAPSHOT=<xml> -DWORK=<dir> -DHOOMD_CLUSTER=<exe>
+#         -DCLOUT_ANA=<exe> -DXML2GSD=<exe> -P cluster_tests.cmake
+# Every case clusters the snapshot in two ways that must agree:
+#   cell_list  the linked-cell list and --brute_force write the same files
+#   formats    text, --binary and --compress analyse alike with clout_ana2
+#   stats_only --stats-only writes what clout_ana2 makes of the text files
+#   slabs      --slabs on a GSD copy matches the in-memory --stats-only run
+#   verlet     --verlet over two snapshots matches the plain run
+#   reorder    --reorder morton and hilbert match --reorder none
+
+set(TYPES --types A T --pbc)
+
+# Runs hoomd_cluster2 (or `exe`) with the arguments in `dir`, a fresh directory
+function(run_in dir exe)
+    file(REMOVE_RECURSE ${dir})
+    file(MAKE_DIRECTORY ${dir})
+    execute_process(COMMAND ${exe} ${ARGN} WORKING_DIRECTORY ${dir}
+                    RESULT_VARIABLE result OUTPUT_FILE ${dir}/log ERROR_FILE ${dir}/log.err)
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "${exe} ${ARGN} failed in ${dir}: ${result}")
+    endif()
+endfunction()
+
+# Runs clout_ana2 on the index `index` in `dir`
+function(analyse dir index)
+    execute_process(COMMAND ${CLOUT_ANA} ${index} WORKING_DIRECTORY ${dir}
+                    RESULT_VARIABLE result OUTPUT_QUIET)
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "clout_ana2 ${index} failed in ${dir}: ${result}")
+    endif()
+endfunction()
+
+function(compare a b)
+    execute_process(COMMAND ${CMAKE_COMMAND} -E compare_files ${a} ${b} RESULT_VARIABLE result)
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "${a} and ${b} differ")
+    endif()
+endfunction()
+
+# Every output file of `a` (not the logs) is in `b` with the same content
+function(compare_dirs a b)
+    file(GLOB files RELATIVE ${a} ${a}/*)
+    list(REMOVE_ITEM files log log.err)
+    if(NOT files)
+        message(FATAL_ERROR "no output in ${a}")
+    endif()
+    foreach(f ${files})
+        compare(${a}/${f} ${b}/${f})
+    endforeach()
+endfunction()
+
+# The numbers of a file, with the leading frame index of every line dropped
+# if `drop_index` (the --stats-only files, one frame)
+function(numbers_of path drop_index out)
+    file(STRINGS ${path} lines)
+    set(numbers "")
+    foreach(line ${lines})
+        if(line MATCHES "^#")
+            continue()
+        endif()
+        if(drop_index)
+            string(REGEX REPLACE "^0 " "" line "${line}")
+        endif()
+        string(REGEX MATCHALL "[0-9]+" n "${line}")
+        list(APPEND numbers ${n})
+    endforeach()
+    set(${out} "${numbers}" PARENT_SCOPE)
+endfunction()
+
+# The --stats-only files of `selection` in `stats` against the clout_ana2
+# output of the text run in `text`
+function(compare_stats stats text selection stem)
+    compare(${stats}/clusterfiles_${selection}.summary ${text}/clusterfiles_${selection}.summary)
+    foreach(ext hist largest_cluster)
+        numbers_of(${stats}/clusterfiles_${selection}.${ext} TRUE expected)
+        numbers_of(${text}/${stem}.${ext} FALSE actual)
+        if(NOT expected STREQUAL actual)
+            message(FATAL_ERROR "${stats}/clusterfiles_${selection}.${ext} and ${text}/${stem}.${ext} differ")
+        endif()
+    endforeach()
+endfunction()
+
+set(INDEXES all_particles_type_A all_particles_type_T molecules)
+
+if(CASE STREQUAL "cell_list")
+    run_in(${WORK}/cell ${HOOMD_CLUSTER} --xml ${SNAPSHOT} ${TYPES} --molecules)
+    run_in(${WORK}/brute ${HOOMD_CLUSTER} --xml ${SNAPSHOT} ${TYPES} --molecules --brute_force)
+    compare_dirs(${WORK}/cell ${WORK}/brute)
+
+elseif(CASE STREQUAL "formats")
+    run_in(${WORK}/text ${HOOMD_CLUSTER} --xml ${SNAPSHOT} ${TYPES} --molecules)
+    run_in(${WORK}/binary ${HOOMD_CLUSTER} --xml ${SNAPSHOT} ${TYPES} --molecules --binary)
+    run_in(${WORK}/compress ${HOOMD_CLUSTER} --xml ${SNAPSHOT} ${TYPES} --molecules --compress)
+    foreach(dir text binary compress)
+        foreach(index ${INDEXES})
+            analyse(${WORK}/${dir} clusterfiles_${index}.txt)
+        endforeach()
+    endforeach()
+    file(GLOB analysis RELATIVE ${WORK}/text ${WORK}/text/*.summary ${WORK}/text/*.hist
+                                             ${WORK}/text/*.largest_cluster)
+    foreach(f ${analysis})
+        compare(${WORK}/text/${f} ${WORK}/binary/${f})
+        compare(${WORK}/text/${f} ${WORK}/compress/${f})
+    endforeach()
+
+elseif(CASE STREQUAL "stats_only")
+    run_in(${WORK}/text ${HOOMD_CLUSTER} --xml ${SNAPSHOT} ${TYPES} --molecules)
+    run_in(${WORK}/stats ${HOOMD_CLUSTER} --xml ${SNAPSHOT} ${TYPES} --molecules --stats-only)
+    foreach(index ${INDEXES})
+        analyse(${WORK}/text clusterfiles_${index}.txt)
+    endforeach()
+    compare_stats(${WORK}/stats ${WORK}/text all_particles_type_A snapshot.0326000000_type_A_neighboring)
+    compare_stats(${WORK}/stats ${WORK}/text all_particles_type_T snapshot.0326000000_type_T_neighboring)
+    compare_stats(${WORK}/stats ${WORK}/text molecules snapshot.0326000000_molecules_neighboring)
+
+elseif(CASE STREQUAL "slabs")
+    file(MAKE_DIRECTORY ${WORK})
+    execute_process(COMMAND ${XML2GSD} ${SNAPSHOT} ${WORK}/snapshot.gsd RESULT_VARIABLE result)
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "xml2gsd failed: ${result}")
+    endif()
+    run_in(${WORK}/memory ${HOOMD_CLUSTER} --gsd ${WORK}/snapshot.gsd ${TYPES} --stats-only)
+    run_in(${WORK}/slabs ${HOOMD_CLUSTER} --gsd ${WORK}/snapshot.gsd ${TYPES} --stats-only --slabs 3)
+    file(STRINGS ${WORK}/slabs/log used REGEX "^Slabs: [2-9]")
+    if(NOT used)
+        message(FATAL_ERROR "the frame was not cut into slabs")
+    endif()
+    compare_dirs(${WORK}/memory ${WORK}/slabs)
+
+elseif(CASE STREQUAL "verlet")
+    # Two snapshots, so that the second one is clustered from the kept list
+    file(MAKE_DIRECTORY ${WORK})
+    configure_file(${SNAPSHOT} ${WORK}/snapshot.0326000000.xml COPYONLY)
+    configure_file(${SNAPSHOT} ${WORK}/snapshot.0327000000.xml COPYONLY)
+    set(snapshots ${WORK}/snapshot.0326000000.xml ${WORK}/snapshot.0327000000.xml)
+    run_in(${WORK}/plain ${HOOMD_CLUSTER} --xml ${snapshots} ${TYPES} --workers 1)
+    run_in(${WORK}/verlet ${HOOMD_CLUSTER} --xml ${snapshots} ${TYPES} --workers 1 --verlet 0.3)
+    file(STRINGS ${WORK}/verlet/log reused REGEX "Verlet list: reused")
+    if(NOT reused)
+        message(FATAL_ERROR "the Verlet list was never reused")
+    endif()
+    compare_dirs(${WORK}/plain ${WORK}/verlet)
+
+elseif(CASE STREQUAL "reorder")
+    run_in(${WORK}/none ${HOOMD_CLUSTER} --xml ${SNAPSHOT} ${TYPES} --molecules --reorder none)
+    foreach(order morton hilbert)
+        run_in(${WORK}/${order} ${HOOMD_CLUSTER} --xml ${SNAPSHOT} ${TYPES} --molecules --reorder ${order})
+        compare_dirs(${WORK}/none ${WORK}/${order})
+    endforeach()
+
+else()
+    message(FATAL_ERROR "unknown CASE: ${CASE}")
+endif()
@@ -0,0 +1,170 @@
+// Converts a HOOMD XML snapshot into a one-frame GSD 2.x file, laid out
+// as gsd.c writes it (header, 128-entry index, 1024-byte name buffer, then
+// the chunks), so that the tests can run the GSD paths (--gsd, --slabs)
+// on test/snapshot.0326000000.xml without the gsd library.
+//
+// Usage: xml2gsd <in.xml> <out.gsd>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "gsd_reader.h"
+#include "parser.h"
+
+struct chunk {
+    std::string name;
+    uint8_t type;
+    uint64_t N;
+    uint32_t M;
+    std::vector<char> data;
+};
+
+static void add_chunk(std::vector<chunk> *chunks, const char *name, uint8_t type,
+                      uint64_t N, uint32_t M, const void *data, size_t bytes)
+{
+    chunk c;
+    c.name = name;
+    c.type = type;
+    c.N = N;
+    c.M = M;
+    c.data.assign((const char *)data, (const char *)data + bytes);
+    chunks->push_back(c);
+}
+
+// Names as an N x (longest + 1) character array, NUL padded
+static void add_strings(std::vector<chunk> *chunks, const char *name,
+                        const std::vector<std::string> &strings)
+{
+    size_t width = 1;
+    for (const std::string &s : strings)
+        width = std::max(width, s.size() + 1);
+    std::vector<char> data(strings.size() * width, '\0');
+    for (size_t i = 0; i < strings.size(); i++)
+        memcpy(&data[i * width], strings[i].data(), strings[i].size());
+    add_chunk(chunks, name, GSD_TYPE_CHARACTER, strings.size(), width, data.data(), data.size());
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 3) {
+        printf("Usage: %s <in.xml> <out.gsd>\n", argv[0]);
+        return 1;
+    }
+
+    float *x = NULL, *y = NULL, *z = NULL, *vx = NULL, *vy = NULL, *vz = NULL;
+    int *ix = NULL, *iy = NULL, *iz = NULL;
+    uint16_t *types = NULL;
+    std::vector<std::string> type_names;
+    bond *bonds = NULL;
+    int n = 0, n_bonds = 0, dimensions = 3;
+    float lx, ly, lz, xy, xz, yz;
+    init_parser();
+    if (parse_hoomd_xml(argv[1], &x, &y, &z, &vx, &vy, &vz, &ix, &iy, &iz, &types, &type_names,
+                        &n, &bonds, &n_bonds, &lx, &ly, &lz, &xy, &xz, &yz, &dimensions) != 0) {
+        fprintf(stderr, "Cannot parse %s\n", argv[1]);
+        return 2;
+    }
+
+    // Chunks in the order HOOMD writes them
+    std::vector<chunk> chunks;
+    uint64_t step = 0;
+    float box[6] = {lx, ly, lz, xy, xz, yz};
+    uint8_t dim = (uint8_t)dimensions;
+    uint32_t n_u32 = n, n_bonds_u32 = n_bonds;
+    std::vector<uint32_t> typeid_(types, types + n);
+    std::vector<float> position(3 * (size_t)n);
+    std::vector<int32_t> image(3 * (size_t)n);
+    for (int i = 0; i < n; i++) {
+        position[3 * i] = x[i]; position[3 * i + 1] = y[i]; position[3 * i + 2] = z[i];
+        image[3 * i] = ix[i]; image[3 * i + 1] = iy[i]; image[3 * i + 2] = iz[i];
+    }
+    add_chunk(&chunks, "configuration/step", GSD_TYPE_UINT64, 1, 1, &step, sizeof(step));
+    add_chunk(&chunks, "configuration/dimensions", GSD_TYPE_UINT8, 1, 1, &dim, sizeof(dim));
+    add_chunk(&chunks, "configuration/box", GSD_TYPE_FLOAT, 6, 1, box, sizeof(box));
+    add_chunk(&chunks, "particles/N", GSD_TYPE_UINT32, 1, 1, &n_u32, sizeof(n_u32));
+    add_strings(&chunks, "particles/types", type_names);
+    add_chunk(&chunks, "particles/typeid", GSD_TYPE_UINT32, n, 1,
+              typeid_.data(), typeid_.size() * sizeof(uint32_t));
+    add_chunk(&chunks, "particles/position", GSD_TYPE_FLOAT, n, 3,
+              position.data(), position.size() * sizeof(float));
+    add_chunk(&chunks, "particles/image", GSD_TYPE_INT32, n, 3,
+              image.data(), image.size() * sizeof(int32_t));
+    if (n_bonds > 0) {
+        // Bond types by their "<typei>-<typej>" names, as in the XML
+        std::vector<std::string> bond_types;
+        std::vector<uint32_t> bond_typeid(n_bonds), group(2 * (size_t)n_bonds);
+        for (int b = 0; b < n_bonds; b++) {
+            std::string name = type_names[bonds[b].typei] + "-" + type_names[bonds[b].typej];
+            size_t t = 0;
+            while (t < bond_types.size() && bond_types[t] != name)
+                t++;
+            if (t == bond_types.size())
+                bond_types.push_back(name);
+            bond_typeid[b] = t;
+            group[2 * b] = bonds[b].ai;
+            group[2 * b + 1] = bonds[b].aj;
+        }
+        add_chunk(&chunks, "bonds/N", GSD_TYPE_UINT32, 1, 1, &n_bonds_u32, sizeof(n_bonds_u32));
+        add_strings(&chunks, "bonds/types", bond_types);
+        add_chunk(&chunks, "bonds/typeid", GSD_TYPE_UINT32, n_bonds, 1,
+                  bond_typeid.data(), bond_typeid.size() * sizeof(uint32_t));
+        add_chunk(&chunks, "bonds/group", GSD_TYPE_UINT32, n_bonds, 2,
+                  group.data(), group.size() * sizeof(uint32_t));
+    }
+
+    const size_t index_entries = 128, namelist_bytes = 1024;
+    gsd_file_header h;
+    memset(&h, 0, sizeof(h));
+    h.magic = GSD_MAGIC;
+    h.index_location = sizeof(h);
+    h.index_allocated_entries = index_entries;
+    h.namelist_location = h.index_location + index_entries * sizeof(gsd_index_entry);
+    h.namelist_allocated_entries = namelist_bytes;
+    h.schema_version = (1 << 16) | 4;
+    h.gsd_version = 2 << 16;
+    strcpy(h.application, "xml2gsd");
+    strcpy(h.schema, "hoomd");
+
+    std::vector<char> names(namelist_bytes, '\0');
+    std::vector<gsd_index_entry> index(index_entries);
+    memset(index.data(), 0, index.size() * sizeof(gsd_index_entry));
+    size_t name_pos = 0;
+    int64_t location = h.namelist_location + namelist_bytes;
+    for (size_t c = 0; c < chunks.size(); c++) {
+        memcpy(&names[name_pos], chunks[c].name.c_str(), chunks[c].name.size() + 1);
+        name_pos += chunks[c].name.size() + 1;
+        index[c].frame = 0;
+        index[c].N = chunks[c].N;
+        index[c].location = location;
+        index[c].M = chunks[c].M;
+        index[c].id = c;
+        index[c].type = chunks[c].type;
+        location += chunks[c].data.size();
+    }
+
+    FILE *f = fopen(argv[2], "wb");
+    if (!f) {
+        fprintf(stderr, "Cannot write %s\n", argv[2]);
+        return 2;
+    }
+    fwrite(&h, sizeof(h), 1, f);
+    fwrite(index.data(), sizeof(gsd_index_entry), index.size(), f);
+    fwrite(names.data(), 1, names.size(), f);
+    for (const chunk &c : chunks)
+        fwrite(c.data.data(), 1, c.data.size(), f);
+    bool ok = !ferror(f);
+    if (fclose(f) != 0 || !ok) {
+        fprintf(stderr, "Cannot write %s\n", argv[2]);
+        return 2;
+    }
+
+    free(x); free(y); free(z);
+    free(vx); free(vy); free(vz);
+    free(ix); free(iy); free(iz);
+    free(types);
+    free(bonds);
+    return 0;
+}
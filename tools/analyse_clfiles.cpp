@@ -2,16 +2,18 @@
 #include <fstream>
 #include <string>
 #include <vector>
-#include <map>
 #include <stdexcept> // for runtime_error
 #include <utility>   // for move
+#include "cluster_io.h"
 
 // This function:
-//  1) Reads clusters from inputFile
+//  1) Streams the clusters of inputFile (text or binary cluster file)
 //  2) Builds histogram of cluster sizes
 //  3) Writes histogram to histogramFile
 //  4) Finds and writes the largest cluster’s particle IDs to largestClusterFile
 //  5) Returns minSize, maxSize, and averageSize via reference parameters
+// Only the histogram and the ids of the largest cluster so far are kept,
+// so memory does not grow with the number of clusters.
 void analyzeClusters(const std::string &inputFile,
                      const std::string &histogramFile,
                      const std::string &largestClusterFile,
@@ -20,94 +22,45 @@ void analyzeClusters(const std::string &inputFile,
                      int &maxSize,
                      double &averageSize)
 {
-    // Open the input file
-    std::ifstream infile(inputFile);
-    if (!infile.is_open()) {
+    // Open the input file (text or binary, detected from its content)
+    cluster_reader reader;
+    if (!open_cluster_file(inputFile.c_str(), &reader)) {
         throw std::runtime_error("Failed to open input file: " + inputFile);
     }
 
-    // Parse cluster data into a vector of vectors: clusters[clusterIndex] = list of particle IDs
-    std::vector<std::vector<int>> clusters;
-    std::string line;
-    while (std::getline(infile, line)) {
-        const std::string marker = "Molecules (";
-        std::size_t pos = line.find(marker);
-        if (pos != std::string::npos) {
-            // Parse the integer count in "Molecules (X):"
-            pos += marker.size(); 
-            std::size_t endPos = line.find(')', pos);
-            if (endPos != std::string::npos) {
-                std::string numberStr = line.substr(pos, endPos - pos);
-                int count = 0;
-                try {
-                    count = std::stoi(numberStr);
-                } catch (...) {
-                    // Ignore malformed lines
-                    continue;
-                }
-                if (count < 2) {
-                    for (int i = 0; i < count; ++i) {
-                        if (!std::getline(infile, line)) {
-                            // If file ends unexpectedly, break out
-                            break;
-                        }
-                    }
-                    continue;
-                }
-                // Read 'count' lines for particle IDs
-                std::vector<int> particleIDs;
-                particleIDs.reserve(count);
-                for (int i = 0; i < count; ++i) {
-                    if (!std::getline(infile, line)) {
-                        // If file ends unexpectedly, break out
-                        break;
-                    }
-                    try {
-                        int id = std::stoi(line);
-                        particleIDs.push_back(id);
-                    } catch (...) {
-                        // Ignore parse errors
-                    }
-                }
-                clusters.push_back(std::move(particleIDs));
-            }
+    // Single pass: histogram[size] = number of clusters of that size,
+    // min, max and sum of the sizes (single-particle clusters are not counted)
+    std::vector<long long> histogram;
+    std::vector<int> largest;   // ids of the first cluster of the maximum size
+    long long totalSize = 0;    // to handle potentially large sums
+    Nclusters = 0;
+    minSize = maxSize = 0;
+    averageSize = 0.0;
+
+    const int *ids;
+    int count;
+    while (next_cluster(&reader, &ids, &count)) {
+        if (count < 2)
+            continue;
+        if ((size_t)count >= histogram.size())
+            histogram.resize(count + 1, 0);
+        histogram[count]++;
+        if (Nclusters == 0 || count < minSize)
+            minSize = count;
+        if (Nclusters == 0 || count > maxSize) {
+            maxSize = count;
+            largest.assign(ids, ids + count);
         }
+        totalSize += count;
+        Nclusters++;
     }
-    infile.close();
+    close_cluster_file(&reader);
 
-    // Check if we actually found any clusters
-    // if (clusters.empty()) {
-    //     throw std::runtime_error("No clusters found in the input file.");
-    // }
-    Nclusters = static_cast<int>(clusters.size());
     if (Nclusters == 0) {
         return;
     }
-    // Build histogram, track min, max, sum
-    std::map<int,int> histogram; // clusterSize -> count
-    minSize = static_cast<int>(clusters[0].size());
-    maxSize = static_cast<int>(clusters[0].size());
-    long long totalSize = 0; // to handle potentially large sums
-    size_t minIndex = 0;
-    size_t maxIndex = 0;
-
-    // Compute stats
-    for (size_t i = 0; i < clusters.size(); ++i) {
-        int sz = static_cast<int>(clusters[i].size());
-        histogram[sz]++;
-        
-        if (sz < minSize) {
-            minSize = sz;
-            minIndex = i;
-        }
-        if (sz > maxSize) {
-            maxSize = sz;
-            maxIndex = i;
-        }
-        totalSize += sz;
-    }
 
-    averageSize = static_cast<double>(totalSize) / static_cast<double>(clusters.size());
+    averageSize = static_cast<double>(totalSize) / static_cast<double>(Nclusters);
 
     // Write the histogram to histogramFile
     {
@@ -117,8 +70,9 @@ void analyzeClusters(const std::string &inputFile,
         }
 
         hfile << "Cluster size histogram (size count)\n";
-        for (const auto &kv : histogram) {
-            hfile << kv.first << " " << kv.second << "\n";
+        for (size_t size = 0; size < histogram.size(); ++size) {
+            if (histogram[size] > 0)
+                hfile << size << " " << histogram[size] << "\n";
         }
     }
 
@@ -131,7 +85,7 @@ void analyzeClusters(const std::string &inputFile,
 
         lcfile << "Largest cluster size: " << maxSize << "\n";
         lcfile << "Particle IDs in the largest cluster:\n";
-        for (int id : clusters[maxIndex]) {
+        for (int id : largest) {
             lcfile << id << "\n";
         }
     }
@@ -1,69 +1,139 @@
 #include <analyse_clfiles.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <mutex>
+#include <sstream>
 #include <string>
+#include <thread>
+#include <vector>
+
+// Analysis of one index entry; filled by a worker thread
+struct entry_result {
+    bool done;
+    std::string errors;         // text for stderr
+    std::string row;            // line of the .summary file (empty: skipped)
+    std::string name;           // cluster file without extension
+};
+
+static void analyze_entry(const std::string &clsdata, entry_result *r, size_t indx)
+{
+    std::filesystem::path cls_data_path(clsdata);
+    if (!std::filesystem::is_regular_file(cls_data_path)) {
+        r->errors = "Error opening file: " + clsdata + "! skipping...\n";
+        return;
+    }
+
+    cls_data_path.replace_extension();
+    r->name = cls_data_path.string();
+
+    int Nclusters, minSize, maxSize;
+    double averageSize;
+    try {
+        analyzeClusters(clsdata, cls_data_path.filename().string() + ".hist",
+                        cls_data_path.filename().string() + ".largest_cluster",
+                        Nclusters, minSize, maxSize, averageSize);
+    } catch (const std::exception &ex) {
+        r->errors = std::string(ex.what()) + "! skipping...\n";
+        return;
+    }
+
+    std::ostringstream row;
+    row<<indx<<" "
+       <<Nclusters<<" "<<minSize<<" "<<maxSize<<" "<<averageSize<<" "
+       <<cls_data_path.string()<<"\n";
+    r->row = row.str();
+}
 
 int main(int argc, char **argv) {
-    
-    if (argc != 2) {
-        printf("Usage: %s <clusterfiles_*_particles_type_*.txt>\n", argv[0]);
+
+    int n_threads = std::max(1u, std::thread::hardware_concurrency());
+    if (argc == 4 && !strcmp(argv[2], "--threads"))
+        n_threads = std::max(1, atoi(argv[3]));
+    else if (argc != 2) {
+        printf("Usage: %s <clusterfiles_*_particles_type_*.txt> [--threads <int>]\n", argv[0]);
         return 1;
     }
-    
+
     std::filesystem::path path(argv[1]);
-    
+
     if (!std::filesystem::exists(path)) {
         fprintf(stderr, "File not found: %s! exiting...\n", path.string().c_str());
         return 2;
     }
-    
+
     std::ifstream cls_files(path.string());
-    
+
     if (!cls_files.is_open()) {
         fprintf(stderr, "Error opening file: %s! exiting...\n", path.string().c_str());
         return 3;
     }
 
-    std::string clsdata, xmlfile, ptype, layer;
-    
+    // Cluster file of every index line (the first field; the source,
+    // type and layer fields that follow are not needed)
+    std::vector<std::string> entries;
+    for (std::string line; std::getline(cls_files, line);) {
+        std::istringstream fields(line);
+        std::string clsdata;
+        if (fields >> clsdata)
+            entries.push_back(clsdata);
+    }
+
     path.replace_extension().filename();
-    
+
     std::string sumary_filename = path.string() + ".summary";
-    
+
     std::ofstream summary_file(sumary_filename);
     if (!summary_file.is_open()) {
         fprintf(stderr, "Error opening summary file: %s! exiting...\n", sumary_filename.c_str());
         return 4;
     }
-    
+
     summary_file<<"# index NClusters minSize maxSize averageSize cls_filename\n";
-       
-    for ( size_t indx = 0 ; cls_files >> clsdata >> xmlfile >> ptype >> layer; ++indx)
+
+    // The entries are analysed concurrently and written in index order as
+    // soon as every entry before them is done
+    std::vector<entry_result> results(entries.size());
+    for (auto &r : results)
+        r.done = false;
+    std::atomic<size_t> next_entry(0);
+    std::mutex mutex;
+    std::condition_variable entry_done;
+
+    std::vector<std::thread> workers;
+    n_threads = std::min<size_t>(n_threads, std::max<size_t>(1, entries.size()));
+    for (int t = 0; t < n_threads; t++)
+        workers.emplace_back([&]() {
+            for (size_t k; (k = next_entry++) < entries.size();) {
+                entry_result r;
+                analyze_entry(entries[k], &r, k);
+                std::lock_guard<std::mutex> lock(mutex);
+                results[k] = std::move(r);
+                results[k].done = true;
+                entry_done.notify_one();
+            }
+        });
+
+    for (size_t indx = 0; indx < entries.size(); ++indx)
     {
-        std::filesystem::path cls_data_path(clsdata);
-        std::ifstream cls_data_in(cls_data_path);
-        if (!cls_data_in.is_open()) {
-            fprintf(stderr, "Error opening file: %s! skipping...\n", clsdata.c_str());
+        std::unique_lock<std::mutex> lock(mutex);
+        entry_done.wait(lock, [&] { return results[indx].done; });
+        entry_result r = std::move(results[indx]);
+        lock.unlock();
+
+        fputs(r.errors.c_str(), stderr);
+        if (r.row.empty())
             continue;
-        }
-        
-        cls_data_path.replace_extension();
-        
-        int Nclusters, minSize, maxSize;
-        double averageSize;
-        
-        std::cout<<"Analyzing: "<<cls_data_path.string()<<"\n";
-        
-        analyzeClusters(clsdata, cls_data_path.filename().string() + ".hist", 
-                        cls_data_path.filename().string() + ".largest_cluster", 
-                        Nclusters, minSize, maxSize, averageSize);
-        
-        summary_file<<indx<<" "
-                    <<Nclusters<<" "<<minSize<<" "<<maxSize<<" "<<averageSize<<" "
-                    <<cls_data_path.string()<<"\n";
-        
+        std::cout<<"Analyzing: "<<r.name<<"\n";
+        summary_file<<r.row;
     }
+    for (auto &w : workers)
+        w.join();
     summary_file.close();
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,413 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <filesystem>
+#include <string>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "arena.h"
+#include "cell_list.h"
+#include "clustering.h"
+#include "mdcluster.h"
+#include "molecule.h"
+#include "parser.h"
+#include "pair_kernel.h"
+#include "synthetic_systems.h"
+#include "timing.h"
+
+// Benchmarks of the parser, the neighbour searches and the clustering on
+// synthetic systems. Every function is run `repeat` times per system and
+// size and the fastest run is reported, as one JSON record per
+// (system, size, engine, function).
+
+struct bench_options {
+    std::vector<synthetic_kind> kinds;
+    std::vector<int> sizes;
+    std::vector<neighbor_engine> engines;
+    float cutoff;
+    int repeat;
+    int brute_max;              // largest N run with the brute-force engine
+    uint64_t seed;
+    bool shuffle;               // particles in random order instead of generation order
+    std::string workdir;
+};
+
+// Fastest of the repeats, split by phase
+struct bench_result {
+    double seconds;
+    phase_timings timings;
+    long long n_links, n_clusters;
+    size_t arena_bytes;
+    long rss_growth_kb;         // largest of the repeats, -1 if unknown
+};
+
+static const char *engine_name(neighbor_engine engine)
+{
+    return engine == NEIGHBOR_CELL_LIST ? "cell_list" : "brute_force";
+}
+
+// Links and clusters from the header of a binary cluster file
+static void read_counts(const std::string &path, bench_result *r)
+{
+    cluster_reader reader;
+    r->n_links = r->n_clusters = -1;
+    if (!open_cluster_file(path.c_str(), &reader))
+        return;
+    r->n_links = reader.n_links;
+    r->n_clusters = reader.n_clusters;
+    close_cluster_file(&reader);
+}
+
+// Resident set at the start of a run, with the peak restarted from it
+// (-1 if the peak cannot be restarted)
+static long start_rss()
+{
+    return reset_peak_rss() ? current_rss_kb() : -1;
+}
+
+// Peak resident set of the run above its start
+static long rss_growth(long start)
+{
+    return start < 0 ? -1 : std::max(0L, peak_rss_kb() - start);
+}
+
+static void keep_fastest(bench_result *best, const bench_result &run, int k)
+{
+    long growth = k == 0 ? run.rss_growth_kb : std::max(best->rss_growth_kb, run.rss_growth_kb);
+    if (k == 0 || run.seconds < best->seconds)
+        *best = run;
+    best->rss_growth_kb = growth;
+}
+
+static void print_record(FILE *f, bool *first, const synthetic_system *s, const char *function,
+                         const char *engine, int n_items, const bench_result &r,
+                         const bench_options &opt, long long file_bytes)
+{
+    fprintf(f, "%s\n    {\"system\": \"%s\", \"n\": %d, \"function\": \"%s\"",
+            *first ? "" : ",", synthetic_name(s->kind), s->n_particles, function);
+    *first = false;
+    if (engine)
+        fprintf(f, ", \"engine\": \"%s\", \"cutoff\": %g", engine, opt.cutoff);
+    fprintf(f, ", \"items\": %d, \"seconds\": %.6f, \"particles_per_s\": %.1f",
+            n_items, r.seconds, r.seconds > 0 ? n_items / r.seconds : 0.0);
+    if (file_bytes >= 0)
+        fprintf(f, ", \"file_bytes\": %lld, \"bytes_per_s\": %.1f",
+                file_bytes, r.seconds > 0 ? file_bytes / r.seconds : 0.0);
+    if (engine)
+    {
+        double search = r.timings.seconds[PHASE_PAIRS];
+        fprintf(f, ", \"search_seconds\": %.6f, \"clustering_seconds\": %.6f, \"output_seconds\": %.6f",
+                search, r.timings.seconds[PHASE_CLUSTERS], r.timings.seconds[PHASE_OUTPUT]);
+        // Candidate pairs given to the distance tests, which the engines
+        // differ in, and the links found, which they share
+        fprintf(f, ", \"links\": %lld, \"clusters\": %lld, \"pairs_per_s\": %.1f, \"links_per_s\": %.1f",
+                r.n_links, r.n_clusters,
+                search > 0 ? r.timings.counts[COUNT_PAIRS_TESTED] / search : 0.0,
+                search > 0 ? r.n_links / search : 0.0);
+        fprintf(f, ", \"arena_bytes\": %zu", r.arena_bytes);
+    }
+    fprintf(f, ", \"rss_growth_kb\": %ld}", r.rss_growth_kb);
+    fflush(f);
+}
+
+static void run_system(FILE *out, bool *first, synthetic_kind kind, int n,
+                       const bench_options &opt, frame_arena *arena)
+{
+    synthetic_system s;
+    generate_system(&s, kind, n, opt.seed);
+    if (opt.shuffle)
+        shuffle_system(&s, opt.seed + 1);
+    fprintf(stderr, "%s N=%d\n", synthetic_name(kind), s.n_particles);
+
+    // parse_hoomd_xml
+    std::string xml = opt.workdir + "/" + synthetic_name(kind) + "_" + std::to_string(s.n_particles) + ".xml";
+    if (!write_hoomd_xml(&s, xml.c_str()))
+    {
+        fprintf(stderr, "Cannot write %s\n", xml.c_str());
+        free_system(&s);
+        return;
+    }
+    long long file_bytes = (long long)std::filesystem::file_size(xml);
+    bench_result parse;
+    for (int k = 0; k < opt.repeat; k++)
+    {
+        float *x, *y, *z, *vx, *vy, *vz;
+        int *ix, *iy, *iz;
+        uint16_t *types;
+        std::vector<std::string> type_names;
+        bond *bonds;
+        int n_particles, n_bonds, dimensions;
+        float lx, ly, lz, xy, xz, yz;
+        bench_result run;
+        reset_timings(&run.timings);
+        long rss0 = start_rss();
+        double t0 = wall_time();
+        int status = parse_hoomd_xml(xml.c_str(), &x, &y, &z, &vx, &vy, &vz, &ix, &iy, &iz,
+                                     &types, &type_names, &n_particles, &bonds, &n_bonds,
+                                     &lx, &ly, &lz, &xy, &xz, &yz, &dimensions);
+        run.seconds = wall_time() - t0;
+        run.rss_growth_kb = rss_growth(rss0);
+        if (status != 0)
+        {
+            fprintf(stderr, "Cannot parse %s\n", xml.c_str());
+            break;
+        }
+        free(x); free(y); free(z); free(vx); free(vy); free(vz);
+        free(ix); free(iy); free(iz); free(types); free(bonds);
+        keep_fastest(&parse, run, k);
+    }
+    print_record(out, first, &s, "parse_hoomd_xml", NULL, s.n_particles, parse, opt, file_bytes);
+    remove(xml.c_str());
+
+    // Selection of the A particles (the heads of a bilayer) for neighboring_particles
+    std::vector<float> xa, ya, za;
+    std::vector<int> aindex;
+    for (int i = 0; i < s.n_particles; i++)
+    {
+        if (s.types[i] != 0)
+            continue;
+        xa.push_back(s.x[i]); ya.push_back(s.y[i]); za.push_back(s.z[i]);
+        aindex.push_back(i);
+    }
+
+    // Molecules from the bonds, gathered molecule by molecule for neighboring
+    molecule_index mi;
+    build_molecules(&mi, s.n_particles, s.bonds, s.n_bonds);
+    std::vector<float> xm(s.n_particles), ym(s.n_particles), zm(s.n_particles);
+    std::vector<int> mol_id(mi.n_molecules);
+    for (int k = 0; k < s.n_particles; k++)
+    {
+        int p = mi.mol_particles[k];
+        xm[k] = s.x[p]; ym[k] = s.y[p]; zm[k] = s.z[p];
+    }
+    for (int m = 0; m < mi.n_molecules; m++)
+        mol_id[m] = m;
+
+    std::string out_name = opt.workdir + "/bench_clusters.bin";
+    for (neighbor_engine engine : opt.engines)
+    {
+        if (engine == NEIGHBOR_BRUTE_FORCE && s.n_particles > opt.brute_max)
+            continue;
+
+        bench_result best;
+        for (int k = 0; k < opt.repeat; k++)
+        {
+            bench_result run;
+            reset_timings(&run.timings);
+            arena_reset(arena);
+            long rss0 = start_rss();
+            double t0 = wall_time();
+            neighboring_particles(xa.data(), ya.data(), za.data(), opt.cutoff, (int)xa.size(),
+                                  s.lx, s.ly, s.lz, aindex.data(), out_name.c_str(), true, 3,
+                                  engine, &run.timings, arena);
+            run.seconds = wall_time() - t0;
+            run.rss_growth_kb = rss_growth(rss0);
+            run.arena_bytes = arena->frame_bytes;
+            read_counts(out_name, &run);
+            keep_fastest(&best, run, k);
+        }
+        print_record(out, first, &s, "neighboring_particles", engine_name(engine), (int)xa.size(),
+                     best, opt, -1);
+
+        // The same clustering in memory (labels and CSR, no file)
+        cluster_box box = {s.lx, s.ly, s.lz, true, 3};
+        cluster_options copt = {opt.cutoff, engine};
+        cluster_result result;
+        init_cluster_result(&result);
+        for (int k = 0; k < opt.repeat; k++)
+        {
+            bench_result run;
+            reset_timings(&run.timings);
+            long rss0 = start_rss();
+            double t0 = wall_time();
+            cluster_particles(xa.data(), ya.data(), za.data(), (int)xa.size(), box, copt,
+                              &result, &run.timings, arena);
+            run.seconds = wall_time() - t0;
+            run.rss_growth_kb = rss_growth(rss0);
+            run.arena_bytes = arena->frame_bytes;
+            run.n_links = result.n_links;
+            run.n_clusters = result.n_clusters;
+            keep_fastest(&best, run, k);
+        }
+        free_cluster_result(&result);
+        print_record(out, first, &s, "cluster_particles", engine_name(engine), (int)xa.size(),
+                     best, opt, -1);
+
+        for (int k = 0; k < opt.repeat; k++)
+        {
+            bench_result run;
+            reset_timings(&run.timings);
+            arena_reset(arena);
+            long rss0 = start_rss();
+            double t0 = wall_time();
+            neighboring(xm.data(), ym.data(), zm.data(), opt.cutoff, mi.n_molecules, mi.mol_start,
+                        s.lx, s.ly, s.lz, mol_id.data(), out_name.c_str(), true, 3,
+                        engine, &run.timings, arena);
+            run.seconds = wall_time() - t0;
+            run.rss_growth_kb = rss_growth(rss0);
+            run.arena_bytes = arena->frame_bytes;
+            read_counts(out_name, &run);
+            keep_fastest(&best, run, k);
+        }
+        print_record(out, first, &s, "neighboring", engine_name(engine), s.n_particles,
+                     best, opt, -1);
+    }
+    remove(out_name.c_str());
+
+    free_molecules(&mi);
+    free_system(&s);
+}
+
+// Comma-separated list
+static std::vector<std::string> split_list(const char *arg)
+{
+    std::vector<std::string> items;
+    std::string s(arg);
+    for (size_t pos = 0; pos <= s.size();)
+    {
+        size_t comma = s.find(',', pos);
+        if (comma == std::string::npos)
+            comma = s.size();
+        if (comma > pos)
+            items.push_back(s.substr(pos, comma - pos));
+        pos = comma + 1;
+    }
+    return items;
+}
+
+int main(int argc, char **argv)
+{
+    bench_options opt;
+    opt.sizes = {1000, 10000, 100000, 1000000};
+    opt.engines = {NEIGHBOR_CELL_LIST};
+    opt.cutoff = 1.2f;
+    opt.repeat = 3;
+    opt.brute_max = 20000;
+    opt.seed = 12345;
+    opt.shuffle = false;
+    opt.workdir = ".";
+    const char *out_path = NULL;
+    const char *reorder = "none";
+    int n_threads = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!value && strcmp(arg, "--help"))
+        {
+            fprintf(stderr, "Missing value of %s\n", arg);
+            return 1;
+        }
+        if (!strcmp(arg, "--systems"))
+        {
+            for (const auto &name : split_list(value))
+            {
+                synthetic_kind kind;
+                if (!synthetic_from_name(name.c_str(), &kind))
+                {
+                    fprintf(stderr, "Unknown system: %s (gas, liquid, chains, bilayer)\n", name.c_str());
+                    return 1;
+                }
+                opt.kinds.push_back(kind);
+            }
+        }
+        else if (!strcmp(arg, "--sizes"))
+        {
+            opt.sizes.clear();
+            for (const auto &n : split_list(value))
+                opt.sizes.push_back((int)atof(n.c_str()));
+        }
+        else if (!strcmp(arg, "--engine"))
+        {
+            if (!strcmp(value, "cell"))
+                opt.engines = {NEIGHBOR_CELL_LIST};
+            else if (!strcmp(value, "brute"))
+                opt.engines = {NEIGHBOR_BRUTE_FORCE};
+            else if (!strcmp(value, "both"))
+                opt.engines = {NEIGHBOR_CELL_LIST, NEIGHBOR_BRUTE_FORCE};
+            else
+            {
+                fprintf(stderr, "Unknown engine: %s (cell, brute, both)\n", value);
+                return 1;
+            }
+        }
+        else if (!strcmp(arg, "--cut"))
+            opt.cutoff = atof(value);
+        else if (!strcmp(arg, "--repeat"))
+            opt.repeat = std::max(1, atoi(value));
+        else if (!strcmp(arg, "--brute_max"))
+            opt.brute_max = atoi(value);
+        else if (!strcmp(arg, "--seed"))
+            opt.seed = strtoull(value, NULL, 10);
+        else if (!strcmp(arg, "--shuffle"))
+            opt.shuffle = atoi(value) != 0;
+        else if (!strcmp(arg, "--reorder"))
+        {
+            reorder = value;
+            if (!strcmp(value, "none"))
+                set_cell_order(CELL_ORDER_ROW_MAJOR);
+            else if (!strcmp(value, "morton"))
+                set_cell_order(CELL_ORDER_MORTON);
+            else if (!strcmp(value, "hilbert"))
+                set_cell_order(CELL_ORDER_HILBERT);
+            else
+            {
+                fprintf(stderr, "Unknown reorder: %s (none, morton, hilbert)\n", value);
+                return 1;
+            }
+        }
+        else if (!strcmp(arg, "--threads"))
+            n_threads = atoi(value);
+        else if (!strcmp(arg, "--workdir"))
+            opt.workdir = value;
+        else if (!strcmp(arg, "--out"))
+            out_path = value;
+        else
+        {
+            printf("Usage: %s --systems gas,liquid,chains,bilayer --sizes 1e3,1e4,... --engine cell|brute|both --cut <float> --repeat <int> --brute_max <int> --seed <int> --shuffle 0|1 --reorder none|morton|hilbert --threads <int> --workdir <dir> --out <file.json>\n", argv[0]);
+            return !strcmp(arg, "--help") ? 0 : 1;
+        }
+        i++;
+    }
+    if (opt.kinds.empty())
+        for (int k = 0; k < N_SYNTHETIC_KINDS; k++)
+            opt.kinds.push_back((synthetic_kind)k);
+
+#ifdef _OPENMP
+    if (n_threads > 0)
+        omp_set_num_threads(n_threads);
+    n_threads = omp_get_max_threads();
+#else
+    n_threads = 1;
+#endif
+
+    FILE *out = out_path ? fopen(out_path, "w") : stdout;
+    if (!out)
+    {
+        fprintf(stderr, "Cannot write %s\n", out_path);
+        return 1;
+    }
+    init_parser();
+    set_cluster_format(CLUSTER_BINARY);
+    std::filesystem::create_directories(opt.workdir);
+
+    fprintf(out, "{\n  \"benchmark\": \"cluster_bench\",\n  \"threads\": %d,\n  \"pair_kernel\": \"%s\",\n"
+                 "  \"repeat\": %d,\n  \"seed\": %llu,\n  \"shuffle\": %s,\n  \"reorder\": \"%s\",\n  \"results\": [",
+            n_threads, pair_kernel_isa(), opt.repeat, (unsigned long long)opt.seed,
+            opt.shuffle ? "true" : "false", reorder);
+    bool first = true;
+    frame_arena arena;
+    init_arena(&arena);
+    for (int n : opt.sizes)
+        for (synthetic_kind kind : opt.kinds)
+            run_system(out, &first, kind, n, opt, &arena);
+    free_arena(&arena);
+    fprintf(out, "\n  ]\n}\n");
+    if (out != stdout)
+        fclose(out);
+    return 0;
+}
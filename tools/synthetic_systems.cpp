@@ -0,0 +1,257 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "synthetic_systems.h"
+
+#define CHAIN_LENGTH 100
+#define BOND_LENGTH 0.97f
+#define LIPID_SPACING 1.1f
+
+static const char *kind_names[N_SYNTHETIC_KINDS] = {
+    "gas", "liquid", "chains", "bilayer"
+};
+
+const char *synthetic_name(synthetic_kind kind)
+{
+    return kind_names[kind];
+}
+
+bool synthetic_from_name(const char *name, synthetic_kind *kind)
+{
+    for (int k = 0; k < N_SYNTHETIC_KINDS; k++)
+    {
+        if (!strcmp(name, kind_names[k]))
+        {
+            *kind = (synthetic_kind)k;
+            return true;
+        }
+    }
+    return false;
+}
+
+// splitmix64: small, fast and good enough for placing particles
+static uint64_t next_random(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+// Uniform in [0, 1)
+static float uniform(uint64_t *state)
+{
+    return (next_random(state) >> 40) * (1.0f / 16777216.0f);
+}
+
+// Wraps v into [-L/2, L/2)
+static float wrap(float v, float L)
+{
+    v -= L * floorf(v / L + 0.5f);
+    return v < L * 0.5f ? v : -L * 0.5f;
+}
+
+static void allocate(synthetic_system *s, int n, int n_bonds)
+{
+    s->n_particles = n;
+    s->x = (float *)malloc(sizeof(float) * (n > 0 ? n : 1));
+    s->y = (float *)malloc(sizeof(float) * (n > 0 ? n : 1));
+    s->z = (float *)malloc(sizeof(float) * (n > 0 ? n : 1));
+    s->types = (uint16_t *)calloc(n > 0 ? n : 1, sizeof(uint16_t));
+    s->n_bonds = n_bonds;
+    s->bonds = (bond *)malloc(sizeof(bond) * (n_bonds > 0 ? n_bonds : 1));
+}
+
+static void add_bond(synthetic_system *s, int b, int ai, int aj)
+{
+    s->bonds[b].ai = ai;
+    s->bonds[b].aj = aj;
+    s->bonds[b].typei = s->types[ai];
+    s->bonds[b].typej = s->types[aj];
+}
+
+static void generate_gas(synthetic_system *s, int n, uint64_t *rng)
+{
+    allocate(s, n, 0);
+    s->lx = s->ly = s->lz = cbrtf(n / 0.1f);
+    for (int i = 0; i < n; i++)
+    {
+        s->x[i] = (uniform(rng) - 0.5f) * s->lx;
+        s->y[i] = (uniform(rng) - 0.5f) * s->ly;
+        s->z[i] = (uniform(rng) - 0.5f) * s->lz;
+    }
+}
+
+static void generate_liquid(synthetic_system *s, int n, uint64_t *rng)
+{
+    int m = (int)ceilf(cbrtf((float)n));
+    float a = cbrtf(1.0f / 0.85f);
+    allocate(s, m * m * m, 0);
+    s->lx = s->ly = s->lz = m * a;
+    int i = 0;
+    for (int kz = 0; kz < m; kz++)
+        for (int ky = 0; ky < m; ky++)
+            for (int kx = 0; kx < m; kx++, i++)
+            {
+                s->x[i] = wrap((kx + 0.5f + 0.3f * (uniform(rng) - 0.5f)) * a, s->lx);
+                s->y[i] = wrap((ky + 0.5f + 0.3f * (uniform(rng) - 0.5f)) * a, s->ly);
+                s->z[i] = wrap((kz + 0.5f + 0.3f * (uniform(rng) - 0.5f)) * a, s->lz);
+            }
+}
+
+static void generate_chains(synthetic_system *s, int n, uint64_t *rng)
+{
+    int n_chains = n / CHAIN_LENGTH > 0 ? n / CHAIN_LENGTH : 1;
+    allocate(s, n_chains * CHAIN_LENGTH, n_chains * (CHAIN_LENGTH - 1));
+    s->lx = s->ly = s->lz = cbrtf(s->n_particles / 0.5f);
+    int b = 0;
+    for (int c = 0; c < n_chains; c++)
+    {
+        float px = (uniform(rng) - 0.5f) * s->lx;
+        float py = (uniform(rng) - 0.5f) * s->ly;
+        float pz = (uniform(rng) - 0.5f) * s->lz;
+        for (int k = 0; k < CHAIN_LENGTH; k++)
+        {
+            int i = c * CHAIN_LENGTH + k;
+            if (k > 0)
+            {
+                // Random direction on the unit sphere
+                float cz = 2.0f * uniform(rng) - 1.0f;
+                float phi = 6.2831853f * uniform(rng);
+                float sz = sqrtf(1.0f - cz * cz);
+                px += BOND_LENGTH * sz * cosf(phi);
+                py += BOND_LENGTH * sz * sinf(phi);
+                pz += BOND_LENGTH * cz;
+                add_bond(s, b++, i - 1, i);
+            }
+            s->x[i] = wrap(px, s->lx);
+            s->y[i] = wrap(py, s->ly);
+            s->z[i] = wrap(pz, s->lz);
+        }
+    }
+}
+
+static void generate_bilayer(synthetic_system *s, int n, uint64_t *rng)
+{
+    // Lipids A-T-T on a square grid per leaflet; heads outside, tails inside
+    int per_leaflet = n / 6 > 0 ? n / 6 : 1;
+    int k = (int)ceilf(sqrtf((float)per_leaflet));
+    allocate(s, 6 * per_leaflet, 4 * per_leaflet);
+    s->type_names = {"A", "T"};
+    s->lx = s->ly = k * LIPID_SPACING;
+    s->lz = s->lx > 12.0f ? s->lx : 12.0f;
+    const float depth[3] = {2.5f, 1.6f, 0.7f};
+    int b = 0;
+    for (int leaflet = 0; leaflet < 2; leaflet++)
+    {
+        float side = leaflet == 0 ? 1.0f : -1.0f;
+        for (int l = 0; l < per_leaflet; l++)
+        {
+            float gx = ((l % k) + 0.5f) * LIPID_SPACING - s->lx * 0.5f;
+            float gy = ((l / k) + 0.5f) * LIPID_SPACING - s->ly * 0.5f;
+            int first = 3 * (leaflet * per_leaflet + l);
+            for (int bead = 0; bead < 3; bead++)
+            {
+                int i = first + bead;
+                s->types[i] = bead == 0 ? 0 : 1;
+                s->x[i] = wrap(gx + 0.4f * (uniform(rng) - 0.5f), s->lx);
+                s->y[i] = wrap(gy + 0.4f * (uniform(rng) - 0.5f), s->ly);
+                s->z[i] = side * (depth[bead] + 0.2f * (uniform(rng) - 0.5f));
+            }
+            add_bond(s, b++, first, first + 1);
+            add_bond(s, b++, first + 1, first + 2);
+        }
+    }
+}
+
+void generate_system(synthetic_system *s, synthetic_kind kind, int n, uint64_t seed)
+{
+    uint64_t rng = seed;
+    s->kind = kind;
+    s->type_names = {"A"};
+    switch (kind)
+    {
+    case SYNTHETIC_GAS: generate_gas(s, n, &rng); break;
+    case SYNTHETIC_LIQUID: generate_liquid(s, n, &rng); break;
+    case SYNTHETIC_CHAINS: generate_chains(s, n, &rng); break;
+    default: generate_bilayer(s, n, &rng); break;
+    }
+}
+
+void shuffle_system(synthetic_system *s, uint64_t seed)
+{
+    uint64_t rng = seed;
+    int n = s->n_particles;
+    int *tag = (int *)malloc(sizeof(int) * (n > 0 ? n : 1));
+    for (int i = 0; i < n; i++)
+        tag[i] = i;
+    // Fisher-Yates: tag[i] is the new index of particle i
+    for (int i = n - 1; i > 0; i--)
+    {
+        int j = (int)(next_random(&rng) % (uint64_t)(i + 1));
+        int t = tag[i]; tag[i] = tag[j]; tag[j] = t;
+    }
+
+    float *x = (float *)malloc(sizeof(float) * (n > 0 ? n : 1));
+    float *y = (float *)malloc(sizeof(float) * (n > 0 ? n : 1));
+    float *z = (float *)malloc(sizeof(float) * (n > 0 ? n : 1));
+    uint16_t *types = (uint16_t *)malloc(sizeof(uint16_t) * (n > 0 ? n : 1));
+    for (int i = 0; i < n; i++)
+    {
+        x[tag[i]] = s->x[i];
+        y[tag[i]] = s->y[i];
+        z[tag[i]] = s->z[i];
+        types[tag[i]] = s->types[i];
+    }
+    for (int b = 0; b < s->n_bonds; b++)
+    {
+        s->bonds[b].ai = tag[s->bonds[b].ai];
+        s->bonds[b].aj = tag[s->bonds[b].aj];
+    }
+    free(s->x); free(s->y); free(s->z);
+    free(s->types);
+    s->x = x;
+    s->y = y;
+    s->z = z;
+    s->types = types;
+    free(tag);
+}
+
+bool write_hoomd_xml(const synthetic_system *s, const char *path)
+{
+    FILE *f = fopen(path, "w");
+    if (!f)
+        return false;
+    int n = s->n_particles;
+    fprintf(f, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<hoomd_xml version=\"1.7\">\n");
+    fprintf(f, "<configuration time_step=\"0\" dimensions=\"3\" natoms=\"%d\" >\n", n);
+    fprintf(f, "<box lx=\"%g\" ly=\"%g\" lz=\"%g\" xy=\"0\" xz=\"0\" yz=\"0\"/>\n", s->lx, s->ly, s->lz);
+    fprintf(f, "<position num=\"%d\">\n", n);
+    for (int i = 0; i < n; i++)
+        fprintf(f, "%.6f %.6f %.6f\n", s->x[i], s->y[i], s->z[i]);
+    fprintf(f, "</position>\n<image num=\"%d\">\n", n);
+    for (int i = 0; i < n; i++)
+        fputs("0 0 0\n", f);
+    fprintf(f, "</image>\n<type num=\"%d\">\n", n);
+    for (int i = 0; i < n; i++)
+        fprintf(f, "%s\n", s->type_names[s->types[i]].c_str());
+    fprintf(f, "</type>\n<bond num=\"%d\">\n", s->n_bonds);
+    for (int b = 0; b < s->n_bonds; b++)
+        fprintf(f, "%s-%s %d %d\n", s->type_names[s->bonds[b].typei].c_str(),
+                s->type_names[s->bonds[b].typej].c_str(), s->bonds[b].ai, s->bonds[b].aj);
+    fprintf(f, "</bond>\n</configuration>\n</hoomd_xml>\n");
+    bool ok = !ferror(f);
+    return fclose(f) == 0 && ok;
+}
+
+void free_system(synthetic_system *s)
+{
+    free(s->x); free(s->y); free(s->z);
+    free(s->types);
+    free(s->bonds);
+    s->x = s->y = s->z = NULL;
+    s->types = NULL;
+    s->bonds = NULL;
+    s->n_particles = s->n_bonds = 0;
+}